@@ -9,57 +9,145 @@
 //===--------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Utils/LocalOpts.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include <array>
 
 using namespace llvm;
+using namespace llvm::PatternMatch;
+
+#define DEBUG_TYPE "localopts"
+
+STATISTIC(NumAlgebraicIdentity, "Number of algebraic identities removed");
+STATISTIC(NumMulToShift, "Number of multiplications replaced by a shift");
+STATISTIC(NumMulDecomposed,
+          "Number of multiplications decomposed into shifts and adds");
+STATISTIC(NumMulKept, "Number of multiplications kept for cost reasons");
+STATISTIC(NumDivStrengthReduced,
+          "Number of divisions and remainders strength reduced");
+STATISTIC(NumMultiInstruction,
+          "Number of instructions removed by multi-instruction optimization");
+STATISTIC(NumReassociated, "Number of associative chains rebuilt");
+STATISTIC(NumDeadErased, "Number of dead instructions erased");
+
+static cl::opt<bool> MagicDivision(
+    "localopts-magic-div", cl::init(false), cl::Hidden,
+    cl::desc("Lower division and remainder by any integer constant to "
+             "multiply-high and shift sequences"));
+
+static cl::opt<bool> Reassociate(
+    "localopts-reassociate", cl::init(true), cl::Hidden,
+    cl::desc("Flatten add/sub and mul/shl chains across blocks and fold "
+             "their constants before the local rewrite rules"));
+
+static cl::opt<unsigned> MulCostOverride(
+    "localopts-mul-cost", cl::init(0), cl::Hidden,
+    cl::desc("Cost of a native mul, in shift/add units, used to decide the "
+             "shift/add decomposition of a multiplication by a constant "
+             "(0 uses TargetTransformInfo)"));
+
+// Costante intera scalare oppure vettore con la stessa costante in ogni lane
+// (splat). Per le costanti vettoriali non uniformi restituisce nullptr.
+const APInt *getSplatConstant(Value *V) {
+  const APInt *C = nullptr;
+  return match(V, m_APInt(C)) ? C : nullptr;
+}
+
+// Costante vettoriale non uniforme in cui ogni lane soddisfa Pred: restituisce
+// il vettore ottenuto applicando Transform lane per lane, altrimenti nullptr.
+Constant *mapConstantLanes(Value *V, function_ref<bool(const APInt &)> Pred,
+                           function_ref<APInt(const APInt &)> Transform) {
+  auto *C = dyn_cast<Constant>(V);
+  auto *VecTy = dyn_cast<FixedVectorType>(V->getType());
+  if (!C || !VecTy)
+    return nullptr;
+
+  SmallVector<Constant *, 16> Lanes;
+  for (unsigned i = 0; i < VecTy->getNumElements(); i++) {
+    auto *Lane = dyn_cast_or_null<ConstantInt>(C->getAggregateElement(i));
+    if (!Lane || !Pred(Lane->getValue()))
+      return nullptr;
+
+    Lanes.push_back(
+        ConstantInt::get(Lane->getType(), Transform(Lane->getValue())));
+  }
+
+  return ConstantVector::get(Lanes);
+}
+
+// Contesto condiviso da tutte le regole di riscrittura
+struct RuleContext {
+  const TargetTransformInfo &TTI;
+  OptimizationRemarkEmitter &ORE;
+};
 
 /**
 0. Sostitiusce l'operazioni di moltiplicazione
   che ha tra gli operandi una costante che
   è una potenza di 2 con una shift (strength reduction)
+
+  Sui vettori la costante può essere uno splat oppure avere una potenza di 2
+  diversa in ogni lane: in quel caso si usa una shift con quantità per lane,
+  solo se per il target non costa più della moltiplicazione.
 */
 bool mutltipicationStrengthReduction(Instruction &Inst,
-                                     Instruction::BinaryOps OptType) {
-  auto *BinOp = dyn_cast<BinaryOperator>(&Inst);
-  if (!BinOp)
-    return false;
-
-  if (BinOp->getOpcode() != Instruction::Mul &&
-      BinOp->getOpcode() != Instruction::UDiv &&
-      BinOp->getOpcode() != Instruction::SDiv)
-    return false;
-
+                                     Instruction::BinaryOps OptType,
+                                     const RuleContext &Ctx) {
   int pos = 0;
   // Ciclo su tutti gli operandi dell'istruzione
   for (auto operand = Inst.op_begin(); operand != Inst.op_end();
        operand++, pos++) {
 
-    ConstantInt *IntOperand = dyn_cast<ConstantInt>(operand);
-    if (!IntOperand)
-      continue;
+    // Calcolo il valore dello shift (uno splat o una costante per lane)
+    Constant *ShiftAmount = nullptr;
+    if (const APInt *IntVal = getSplatConstant(*operand)) {
+      // Se l'operando non è una costante che è una potenza di 2 si passa
+      // all'iterazione successiva
+      if (!IntVal->isPowerOf2()) {
+        continue;
+      }
 
-    APInt IntVal = IntOperand->getValue();
+      ShiftAmount = ConstantInt::get(Inst.getType(), IntVal->exactLogBase2());
+    } else {
+      ShiftAmount = mapConstantLanes(
+          *operand, [](const APInt &Lane) { return Lane.isPowerOf2(); },
+          [](const APInt &Lane) {
+            return APInt(Lane.getBitWidth(), Lane.exactLogBase2());
+          });
+      if (!ShiftAmount)
+        continue;
 
-    // Se l'operando non è una costante che è una potenza di 2 si passa
-    // all'iterazione successiva
-    if (!IntVal.isPowerOf2()) {
-      continue;
+      auto CostKind = TargetTransformInfo::TCK_Latency;
+      if (Ctx.TTI.getArithmeticInstrCost(Instruction::Shl, Inst.getType(),
+                                     CostKind) >
+          Ctx.TTI.getArithmeticInstrCost(Instruction::Mul, Inst.getType(),
+                                     CostKind))
+        continue;
     }
 
-    outs() << "Strength Reduction for Multiplication\n"
-           << IntVal << " in  position " << pos << "\n";
-
-    // Calcolo il valore dello shift
-    int shiftValue = IntVal.exactLogBase2();
-
     // Creo l'istruzione di shift
-    Instruction *Shifted = BinaryOperator::Create(
-        OptType == Instruction::Mul ? Instruction::Shl : Instruction::AShr,
-        Inst.getOperand(1 - pos),                           // L'altro operando
-        ConstantInt::get(IntOperand->getType(), shiftValue) // Costante di shift
+    Instruction *Shifted = BinaryOperator::CreateShl(
+        Inst.getOperand(1 - pos), // L'altro operando
+        ShiftAmount               // Costante di shift
     );
 
     // Inserisco l'istruzione di shift dopo Inst
@@ -67,11 +155,13 @@ bool mutltipicationStrengthReduction(Instruction &Inst,
     // Sostituisco tutte le occorrenze dell'istruzione Inst con lo shift
     Inst.replaceAllUsesWith(Shifted);
 
-    outs() << "Shifted\n";
-    Shifted->print(outs());
-    outs() << "\nResult";
-    Inst.print(outs());
-    outs() << "\n";
+    LLVM_DEBUG(dbgs() << "LocalOpts: " << Inst << " -> " << *Shifted << "\n");
+    ++NumMulToShift;
+    Ctx.ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "MulToShift", &Inst)
+             << "multiplication by " << ore::NV("Constant", operand->get())
+             << " replaced by a shift";
+    });
     return true;
   }
 
@@ -85,32 +175,40 @@ bool mutltipicationStrengthReduction(Instruction &Inst,
   𝑥 × 1 = 1 × 𝑥 -> x
   x / 1 -> x
 */
-bool algebraicIdentity(Instruction &Inst, Instruction::BinaryOps OptType) {
+bool algebraicIdentity(Instruction &Inst, Instruction::BinaryOps OptType,
+                       const RuleContext &Ctx) {
+  auto EmitRemark = [&](Value *IntOperand) {
+    ++NumAlgebraicIdentity;
+    Ctx.ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "AlgebraicIdentity", &Inst)
+             << ore::NV("Opcode", Inst.getOpcodeName()) << " by "
+             << ore::NV("Constant", IntOperand) << " removed";
+    });
+  };
+
   // Se l'operazione è una divisione(S -> signed || U -> unsigned)
   if (OptType == Instruction::UDiv || OptType == Instruction::SDiv) {
-    APInt IntVal = (dyn_cast<ConstantInt>(Inst.getOperand(1)))->getValue();
+    Value *Divisor = Inst.getOperand(1);
+    const APInt *IntVal = getSplatConstant(Divisor);
+    if (!IntVal)
+      return false;
 
     // Se il divisore è 1
-    if (IntVal.isOne()) {
-      outs() << "Algebraic-Identity for Division\n"
-             << IntVal << " in  position 2"
-             << "\n";
-
+    if (IntVal->isOne()) {
+      LLVM_DEBUG(dbgs() << "LocalOpts: " << Inst << " -> identity\n");
+      EmitRemark(Divisor);
       Inst.replaceAllUsesWith(Inst.getOperand(0));
       return true;
     }
 
-    // Se il divisore è -1
-    if (IntVal.isAllOnes()) {
-      outs() << "Algebraic-Identity for Division\n"
-             << IntVal << " in  position 2"
-             << "\n";
-      APInt OtherOperandVal =
-          (dyn_cast<ConstantInt>(Inst.getOperand(0)))->getValue();
-      OtherOperandVal.setSignBit();
-
-      Inst.replaceAllUsesWith(
-          ConstantInt::get(Inst.getOperand(0)->getType(), OtherOperandVal));
+    // Se il divisore è -1 (solo per la divisione con segno): x / -1 -> 0 - x
+    if (OptType == Instruction::SDiv && IntVal->isAllOnes()) {
+      LLVM_DEBUG(dbgs() << "LocalOpts: " << Inst << " -> negation\n");
+      EmitRemark(Divisor);
+      Instruction *Negated = BinaryOperator::CreateNeg(Inst.getOperand(0));
+      Negated->insertAfter(&Inst);
+      Inst.replaceAllUsesWith(Negated);
+      return true;
     }
 
     return false;
@@ -120,233 +218,1061 @@ bool algebraicIdentity(Instruction &Inst, Instruction::BinaryOps OptType) {
   for (auto operand = Inst.op_begin(); operand != Inst.op_end();
        operand++, pos++) {
 
-    ConstantInt *IntOperand = dyn_cast<ConstantInt>(operand);
-    if (!IntOperand)
+    const APInt *IntVal = getSplatConstant(*operand);
+    if (!IntVal)
       continue;
 
-    APInt IntVal = IntOperand->getValue();
-
-    if ((OptType == Instruction::Mul && IntVal.isOne()) ||
-        (OptType == Instruction::Add && IntVal.isZero()) ||
-        (OptType == Instruction::Sub && IntVal.isZero() && pos == 1)) {
-
-      outs() << "Algebraic-Identity \nFor value " << IntVal << " in position "
-             << pos << "\n";
-      Inst.print(outs());
-      outs() << "\n";
-
+    if ((OptType == Instruction::Mul && IntVal->isOne()) ||
+        (OptType == Instruction::Add && IntVal->isZero()) ||
+        (OptType == Instruction::Sub && IntVal->isZero() && pos == 1)) {
+      LLVM_DEBUG(dbgs() << "LocalOpts: " << Inst << " -> identity\n");
+      EmitRemark(*operand);
       Inst.replaceAllUsesWith(Inst.getOperand(1 - pos));
-
-      outs() << "After\n";
-      // Inst.print(outs());
-      outs() << "\n";
-
       return true;
     }
-
-    outs() << "Algebraic-Identity not found\n";
-    Inst.print(outs());
-    outs() << "\n";
   }
 
   return false;
 }
 
+/**
+  Rappresentazione canonical-signed-digit (forma non adiacente) di C.
+  Ogni cifra è -1, 0 o 1 e non ci sono due cifre non nulle adiacenti,
+  quindi il numero di termini di x × C = Σ dᵢ (x ≪ i) è minimo.
+  Le cifre in posizione >= N vengono scartate perché x ≪ N = 0 modulo 2^N.
+  Restituisce le coppie (posizione, segno) delle cifre non nulle.
+*/
+SmallVector<std::pair<unsigned, bool>, 8> getSignedDigits(const APInt &C) {
+  unsigned BitWidth = C.getBitWidth();
+  SmallVector<std::pair<unsigned, bool>, 8> Digits;
+
+  // Un bit in più evita l'overflow quando C + 1 = 2^N
+  APInt Value = C.zext(BitWidth + 1);
+  for (unsigned Pos = 0; !Value.isZero() && Pos < BitWidth; Pos++) {
+    if (Value[0]) {
+      // C mod 4 = 1 -> cifra +1, C mod 4 = 3 -> cifra -1
+      bool IsNegative = Value[1];
+      Digits.push_back({Pos, IsNegative});
+      if (IsNegative)
+        Value += 1;
+      else
+        Value -= 1;
+    }
+    Value.lshrInPlace(1);
+  }
+
+  return Digits;
+}
+
 /**
 2. Strength Reduction (più avanzato)
   15 × 𝑥 = 𝑥 × 15   -> (𝑥 ≪ 4) – x
-  y = x / 8         -> y = x >> 3
-*/
-bool strengthReduction(Instruction &Inst, Instruction::BinaryOps OptType) {
-  auto *BinOp = dyn_cast<BinaryOperator>(&Inst);
-  if (!BinOp)
-    return false;
+  10 × 𝑥 = 𝑥 × 10   -> ((𝑥 ≪ 2) + x) ≪ 1
+  -7 × 𝑥 = 𝑥 × -7   -> x – (𝑥 ≪ 3)
 
-  if (BinOp->getOpcode() != Instruction::Mul &&
-      BinOp->getOpcode() != Instruction::UDiv &&
-      BinOp->getOpcode() != Instruction::SDiv)
-    return false;
+  La costante viene scomposta in cifre CSD (dopo aver tolto gli zeri finali,
+  che diventano un'unica shift alla fine). La sequenza di shift e add/sub
+  viene emessa solo se il suo costo secondo TargetTransformInfo è minore di
+  quello della moltiplicazione nativa. Sui vettori si gestiscono solo gli
+  splat, perché la sequenza deve essere la stessa in ogni lane.
+*/
+bool strengthReduction(Instruction &Inst, Instruction::BinaryOps OptType,
+                       const RuleContext &Ctx) {
+  Type *Ty = Inst.getType();
+  // La sequenza sostituisce una singola mul sul cammino critico, quindi
+  // si confrontano le latenze
+  auto CostKind = TargetTransformInfo::TCK_Latency;
+  InstructionCost MulCost =
+      MulCostOverride ? InstructionCost(MulCostOverride)
+                      : Ctx.TTI.getArithmeticInstrCost(Instruction::Mul, Ty,
+                                                   CostKind);
+  InstructionCost ShlCost =
+      MulCostOverride ? InstructionCost(1)
+                      : Ctx.TTI.getArithmeticInstrCost(Instruction::Shl, Ty,
+                                                   CostKind);
+  InstructionCost AddCost =
+      MulCostOverride ? InstructionCost(1)
+                      : Ctx.TTI.getArithmeticInstrCost(Instruction::Add, Ty,
+                                                   CostKind);
 
   int pos = 0;
   for (auto operand = Inst.op_begin(); operand != Inst.op_end();
        operand++, pos++) {
 
-    ConstantInt *IntOperand = dyn_cast<ConstantInt>(operand);
+    const APInt *IntOperand = getSplatConstant(*operand);
     if (!IntOperand)
       continue;
 
-    APInt IntVal = IntOperand->getValue();
-    Instruction::BinaryOps complOpt;
+    APInt IntVal = *IntOperand;
+    if (IntVal.isZero())
+      continue;
 
-    int shiftValue = 0;
-    if ((IntVal - 1).isPowerOf2()) {
-      shiftValue = (IntVal - 1).exactLogBase2();
-      complOpt = Instruction::Add;
-    } else if ((IntVal + 1).isPowerOf2()) {
-      shiftValue = (IntVal + 1).exactLogBase2();
-      complOpt = Instruction::Sub;
-    } else {
+    // Dopo la shift finale contano solo i BitWidth - TrailingZeros bit bassi
+    // della parte dispari: sulla larghezza piena una costante pari negativa
+    // diventerebbe un grande numero positivo (x × -8 -> ((x ≪ 29) - x) ≪ 3
+    // invece di -(x ≪ 3))
+    unsigned TrailingZeros = IntVal.countr_zero();
+    unsigned BitWidth = IntVal.getBitWidth();
+    auto Digits = getSignedDigits(
+        IntVal.lshr(TrailingZeros).trunc(BitWidth - TrailingZeros));
+
+    // Una add/sub per ogni termine oltre il primo, una shift per ogni termine
+    // spostato, più la shift finale per gli zeri tolti. Se tutti i termini
+    // sono negativi serve anche una negazione.
+    bool HasPositive = any_of(Digits, [](const auto &D) { return !D.second; });
+    unsigned NumShifts = (TrailingZeros ? 1 : 0);
+    for (const auto &Digit : Digits) {
+      if (Digit.first)
+        NumShifts++;
+    }
+    unsigned NumAdds = Digits.size() - 1 + (HasPositive ? 0 : 1);
+
+    InstructionCost SequenceCost = ShlCost * NumShifts + AddCost * NumAdds;
+    if (!SequenceCost.isValid() || !MulCost.isValid() ||
+        SequenceCost >= MulCost) {
+      ++NumMulKept;
+      Ctx.ORE.emit([&]() {
+        return OptimizationRemarkMissed(DEBUG_TYPE, "MulKept", &Inst)
+               << "multiplication by " << ore::NV("Constant", operand->get())
+               << " kept: shift/add sequence cost "
+               << ore::NV("SequenceCost", SequenceCost)
+               << " is not lower than mul cost "
+               << ore::NV("MulCost", MulCost);
+      });
       continue;
     }
 
-    Instruction *Shifted = BinaryOperator::CreateShl(
-        Inst.getOperand(1 - pos),
-        ConstantInt::get(IntOperand->getType(), shiftValue));
+    Value *X = Inst.getOperand(1 - pos);
+    IRBuilder<> Builder(Inst.getNextNode());
+
+    // Il primo termine positivo fa da accumulatore
+    Value *Result = nullptr;
+    if (HasPositive) {
+      auto First = find_if(Digits, [](const auto &D) { return !D.second; });
+      Result = First->first ? Builder.CreateShl(X, First->first) : X;
+      Digits.erase(First);
+    } else {
+      Result = ConstantInt::get(Ty, 0);
+    }
 
-    Instruction *ComplInstruction =
-        BinaryOperator::Create(complOpt, Inst.getOperand(1 - pos), Shifted);
+    for (const auto &Digit : Digits) {
+      Value *Term = Digit.first ? Builder.CreateShl(X, Digit.first) : X;
+      Result = Digit.second ? Builder.CreateSub(Result, Term)
+                            : Builder.CreateAdd(Result, Term);
+    }
 
-    Shifted->insertAfter(&Inst);
-    ComplInstruction->insertAfter(Shifted);
-    Inst.replaceAllUsesWith(ComplInstruction);
-
-    outs() << "Strength Reduction for Multiplication\n"
-           << IntVal << " in  position " << pos << "\n";
-    outs() << "Shifted\n";
-    Shifted->print(outs());
-    outs() << "\nComplInstruction\n";
-    ComplInstruction->print(outs());
-    outs() << "\nResult";
-    Inst.print(outs());
-    outs() << "\n";
+    if (TrailingZeros)
+      Result = Builder.CreateShl(Result, TrailingZeros);
 
+    LLVM_DEBUG(dbgs() << "LocalOpts: " << Inst << " -> " << *Result
+                      << " (cost " << SequenceCost << " instead of " << MulCost
+                      << ")\n");
+    ++NumMulDecomposed;
+    Ctx.ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "MulDecomposed", &Inst)
+             << "multiplication by " << ore::NV("Constant", operand->get())
+             << " decomposed into shifts and adds (cost "
+             << ore::NV("SequenceCost", SequenceCost) << " instead of "
+             << ore::NV("MulCost", MulCost) << ")";
+    });
+
+    Inst.replaceAllUsesWith(Result);
     return true;
   }
 
   return false;
 }
 
+/**
+  Magic number per la divisione senza segno (Hacker's Delight, cap. 10).
+  Restituisce il moltiplicatore M e lo shift S tali che
+    x / d = mulhu(x, M) >> S
+  Se IsAdd è vero M non sta in N bit e serve la correzione
+    t = mulhu(x, M), q = (((x - t) >> 1) + t) >> (S - 1)
+*/
+struct UnsignedMagic {
+  APInt Magic;
+  unsigned Shift;
+  bool IsAdd;
+};
+
+UnsignedMagic computeUnsignedMagic(const APInt &D) {
+  unsigned BitWidth = D.getBitWidth();
+  APInt AllOnes = APInt::getAllOnes(BitWidth);
+  APInt SignedMin = APInt::getSignedMinValue(BitWidth);
+  APInt SignedMax = APInt::getSignedMaxValue(BitWidth);
+  bool IsAdd = false;
+
+  APInt NC = AllOnes - (AllOnes - D).urem(D);
+  unsigned P = BitWidth - 1;
+  APInt Q1 = SignedMin.udiv(NC);  // Q1 = 2^P / NC
+  APInt R1 = SignedMin - Q1 * NC; // R1 = rem(2^P, NC)
+  APInt Q2 = SignedMax.udiv(D);   // Q2 = (2^P - 1) / D
+  APInt R2 = SignedMax - Q2 * D;  // R2 = rem(2^P - 1, D)
+  APInt Delta;
+
+  do {
+    P = P + 1;
+    if (R1.uge(NC - R1)) {
+      Q1 = Q1 + Q1 + 1;
+      R1 = R1 + R1 - NC;
+    } else {
+      Q1 = Q1 + Q1;
+      R1 = R1 + R1;
+    }
+
+    if ((R2 + 1).uge(D - R2)) {
+      if (Q2.uge(SignedMax))
+        IsAdd = true;
+      Q2 = Q2 + Q2 + 1;
+      R2 = R2 + R2 + 1 - D;
+    } else {
+      if (Q2.uge(SignedMin))
+        IsAdd = true;
+      Q2 = Q2 + Q2;
+      R2 = R2 + R2 + 1;
+    }
+    Delta = D - 1 - R2;
+  } while (P < BitWidth * 2 &&
+           (Q1.ult(Delta) || (Q1 == Delta && R1.isZero())));
+
+  return {Q2 + 1, P - BitWidth, IsAdd};
+}
+
+/**
+  Magic number per la divisione con segno (Hacker's Delight, cap. 10).
+  Restituisce il moltiplicatore M e lo shift S tali che
+    q = mulhs(x, M) (+ x se d > 0 e M < 0, - x se d < 0 e M > 0)
+    x / d = (q >> S) + segno(q)
+*/
+struct SignedMagic {
+  APInt Magic;
+  unsigned Shift;
+};
+
+SignedMagic computeSignedMagic(const APInt &D) {
+  unsigned BitWidth = D.getBitWidth();
+  APInt SignedMin = APInt::getSignedMinValue(BitWidth);
+
+  APInt AD = D.abs();
+  APInt T = SignedMin + D.lshr(BitWidth - 1);
+  APInt ANC = T - 1 - T.urem(AD); // |NC|
+  unsigned P = BitWidth - 1;
+  APInt Q1 = SignedMin.udiv(ANC);  // Q1 = 2^P / |NC|
+  APInt R1 = SignedMin - Q1 * ANC; // R1 = rem(2^P, |NC|)
+  APInt Q2 = SignedMin.udiv(AD);   // Q2 = 2^P / |D|
+  APInt R2 = SignedMin - Q2 * AD;  // R2 = rem(2^P, |D|)
+  APInt Delta;
+
+  do {
+    P = P + 1;
+    Q1 = Q1 << 1;
+    R1 = R1 << 1;
+    if (R1.uge(ANC)) {
+      Q1 = Q1 + 1;
+      R1 = R1 - ANC;
+    }
+
+    Q2 = Q2 << 1;
+    R2 = R2 << 1;
+    if (R2.uge(AD)) {
+      Q2 = Q2 + 1;
+      R2 = R2 - AD;
+    }
+    Delta = AD - R2;
+  } while (Q1.ult(Delta) || (Q1 == Delta && R1.isZero()));
+
+  APInt Magic = Q2 + 1;
+  if (D.isNegative())
+    Magic = -Magic;
+
+  return {Magic, P - BitWidth};
+}
+
+// Parte alta del prodotto su 2N bit, il multiply-high che il backend
+// riconosce (mulhu/mulhs). Per i vettori si estende ogni lane.
+Value *createMulHigh(IRBuilder<> &Builder, Value *X, const APInt &Magic,
+                     bool IsSigned) {
+  Type *Ty = X->getType();
+  unsigned BitWidth = Ty->getScalarSizeInBits();
+  Type *WideTy = Ty->getWithNewBitWidth(BitWidth * 2);
+
+  Value *WideX =
+      IsSigned ? Builder.CreateSExt(X, WideTy) : Builder.CreateZExt(X, WideTy);
+  Value *WideMagic = ConstantInt::get(
+      WideTy, IsSigned ? Magic.sext(BitWidth * 2) : Magic.zext(BitWidth * 2));
+  Value *Product = Builder.CreateMul(WideX, WideMagic);
+
+  return Builder.CreateTrunc(Builder.CreateLShr(Product, BitWidth), Ty);
+}
+
+// Quoziente di x / d con d potenza di 2 (eventualmente negata).
+// La shift aritmetica da sola arrotonda verso -inf, quindi per i dividendi
+// negativi si somma prima d - 1 così da arrotondare verso 0.
+Value *createSignedPow2Quotient(IRBuilder<> &Builder, Value *X,
+                                const APInt &D) {
+  unsigned BitWidth = D.getBitWidth();
+  unsigned Log2 = D.abs().logBase2();
+
+  Value *Sign = Builder.CreateAShr(X, BitWidth - 1);
+  Value *Bias = Builder.CreateLShr(Sign, BitWidth - Log2);
+  Value *Quotient = Builder.CreateAShr(Builder.CreateAdd(X, Bias), Log2);
+
+  return D.isNegative() ? Builder.CreateNeg(Quotient) : Quotient;
+}
+
+Value *createUnsignedMagicQuotient(IRBuilder<> &Builder, Value *X,
+                                   const APInt &D) {
+  UnsignedMagic Magic = computeUnsignedMagic(D);
+  Value *High = createMulHigh(Builder, X, Magic.Magic, false);
+
+  if (!Magic.IsAdd)
+    return Builder.CreateLShr(High, Magic.Shift);
+
+  Value *Fixup = Builder.CreateLShr(Builder.CreateSub(X, High), 1);
+  return Builder.CreateLShr(Builder.CreateAdd(Fixup, High), Magic.Shift - 1);
+}
+
+Value *createSignedMagicQuotient(IRBuilder<> &Builder, Value *X,
+                                 const APInt &D) {
+  unsigned BitWidth = D.getBitWidth();
+  SignedMagic Magic = computeSignedMagic(D);
+  Value *Quotient = createMulHigh(Builder, X, Magic.Magic, true);
+
+  // Correzione quando il magic number ha segno opposto al divisore
+  if (D.isStrictlyPositive() && Magic.Magic.isNegative())
+    Quotient = Builder.CreateAdd(Quotient, X);
+  else if (D.isNegative() && Magic.Magic.isStrictlyPositive())
+    Quotient = Builder.CreateSub(Quotient, X);
+
+  Quotient = Builder.CreateAShr(Quotient, Magic.Shift);
+
+  // Arrotondamento verso 0: si aggiunge 1 se il quoziente è negativo
+  Value *SignBit = Builder.CreateLShr(Quotient, BitWidth - 1);
+  return Builder.CreateAdd(Quotient, SignBit);
+}
+
+// udiv/urem per un vettore di potenze di 2 diverse: lshr e and per lane
+bool perLaneDivisionStrengthReduction(Instruction &Inst,
+                                      Instruction::BinaryOps OptType,
+                                      OptimizationRemarkEmitter &ORE) {
+  bool IsRem = OptType == Instruction::URem;
+  Constant *LaneConstants = mapConstantLanes(
+      Inst.getOperand(1), [](const APInt &Lane) { return Lane.isPowerOf2(); },
+      [IsRem](const APInt &Lane) {
+        return IsRem ? Lane - 1 : APInt(Lane.getBitWidth(), Lane.logBase2());
+      });
+  if (!LaneConstants)
+    return false;
+
+  Instruction *Result = BinaryOperator::Create(
+      IsRem ? Instruction::And : Instruction::LShr, Inst.getOperand(0),
+      LaneConstants);
+  Result->insertAfter(&Inst);
+
+  LLVM_DEBUG(dbgs() << "LocalOpts: " << Inst << " -> " << *Result << "\n");
+  ++NumDivStrengthReduced;
+  ORE.emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "DivStrengthReduced", &Inst)
+           << ore::NV("Opcode", Inst.getOpcodeName()) << " by "
+           << ore::NV("Constant", Inst.getOperand(1))
+           << " replaced by a per-lane " << (IsRem ? "and" : "shift");
+  });
+
+  Inst.replaceAllUsesWith(Result);
+  return true;
+}
+
+/**
+4. Division Strength Reduction
+  x /u 2^k -> x >> k
+  x %u 2^k -> x & (2^k - 1)
+  x /s 2^k -> (x + ((x >>s (n - 1)) >>u (n - k))) >>s k
+  x %s 2^k -> x - (x /s 2^k) * 2^k
+
+  Con -localopts-magic-div anche la divisione e il resto per una costante
+  qualsiasi vengono sostituiti da una moltiplicazione per il magic number
+  seguita da shift (x % d -> x - (x / d) * d).
+
+  Sui vettori il divisore deve essere uno splat, tranne per udiv/urem per
+  potenze di 2 diverse in ogni lane, che diventano shift e and per lane.
+*/
+bool divisionStrengthReduction(Instruction &Inst,
+                               Instruction::BinaryOps OptType,
+                               const RuleContext &Ctx) {
+  Value *Divisor = Inst.getOperand(1);
+  const APInt *SplatDivisor = getSplatConstant(Divisor);
+  if (!SplatDivisor) {
+    return (OptType == Instruction::UDiv || OptType == Instruction::URem) &&
+           perLaneDivisionStrengthReduction(Inst, OptType, Ctx.ORE);
+  }
+
+  APInt D = *SplatDivisor;
+  bool IsSigned = OptType == Instruction::SDiv || OptType == Instruction::SRem;
+  bool IsRem = OptType == Instruction::URem || OptType == Instruction::SRem;
+  bool IsPow2 = IsSigned ? D.abs().isPowerOf2() : D.isPowerOf2();
+
+  // 0, 1 e -1 sono casi gestiti dalle identità algebriche; INT_MIN come
+  // divisore con segno non ha un valore assoluto rappresentabile
+  if (D.isZero() || D.isOne() || (IsSigned && D.isAllOnes()) ||
+      (IsSigned && D.isMinSignedValue()))
+    return false;
+
+  if (!IsPow2 && !MagicDivision)
+    return false;
+
+  Value *X = Inst.getOperand(0);
+  IRBuilder<> Builder(Inst.getNextNode());
+  Value *Result = nullptr;
+
+  if (!IsSigned && IsPow2) {
+    Result = IsRem ? Builder.CreateAnd(X, D - 1)
+                   : Builder.CreateLShr(X, D.logBase2());
+  } else if (IsSigned && IsPow2 && IsRem) {
+    // x - ((x + bias) & -|d|), il resto ha lo stesso segno del dividendo
+    unsigned BitWidth = D.getBitWidth();
+    unsigned Log2 = D.abs().logBase2();
+    Value *Sign = Builder.CreateAShr(X, BitWidth - 1);
+    Value *Bias = Builder.CreateLShr(Sign, BitWidth - Log2);
+    Value *Rounded = Builder.CreateAnd(Builder.CreateAdd(X, Bias), -D.abs());
+    Result = Builder.CreateSub(X, Rounded);
+  } else {
+    Value *Quotient = IsPow2     ? createSignedPow2Quotient(Builder, X, D)
+                      : IsSigned ? createSignedMagicQuotient(Builder, X, D)
+                                 : createUnsignedMagicQuotient(Builder, X, D);
+    Result = IsRem ? Builder.CreateSub(X, Builder.CreateMul(Quotient, Divisor))
+                   : Quotient;
+  }
+
+  LLVM_DEBUG(dbgs() << "LocalOpts: " << Inst << " -> " << *Result << "\n");
+  ++NumDivStrengthReduced;
+  Ctx.ORE.emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "DivStrengthReduced", &Inst)
+           << ore::NV("Opcode", Inst.getOpcodeName()) << " by "
+           << ore::NV("Constant", Divisor) << " replaced by "
+           << (IsPow2 ? "shifts" : "a multiply-high and shifts");
+  });
+
+  Inst.replaceAllUsesWith(Result);
+  return true;
+}
+
 /**
 3. Multi-Instruction Optimization
   𝑎 = 𝑏 + 1, 𝑐 = 𝑎 − 1
   ->
   𝑎 = 𝑏 + 1, 𝑐 = 𝑏
+
+  La regola viene applicata su 𝑐: si controlla se uno dei suoi operandi è
+  definito da un'operazione complementare con la stessa costante. In questo
+  modo il motore a worklist, rimettendo in coda gli utenti dopo ogni
+  sostituzione, trova anche le opportunità create da altre riscritture.
+  Le costanti sono confrontate per identità, quindi la regola vale anche per
+  i vettori, splat o con una costante diversa in ogni lane.
 */
 bool multiInstructionOptimization(Instruction &Inst,
-                                  Instruction::BinaryOps OptType) {
+                                  Instruction::BinaryOps OptType,
+                                  const RuleContext &Ctx) {
+  Instruction::BinaryOps complOpt =
+      OptType == Instruction::Add ? Instruction::Sub : Instruction::Add;
+
   int pos = 0;
   for (auto operand = Inst.op_begin(); operand != Inst.op_end();
        operand++, pos++) {
-    ConstantInt *IntOperand = dyn_cast<ConstantInt>(operand);
+    Constant *IntOperand = dyn_cast<Constant>(operand);
     if (!IntOperand)
       continue;
 
-    APInt IntVal = IntOperand->getValue();
-    Instruction::BinaryOps complOpt =
-        OptType == Instruction::Add ? Instruction::Sub : Instruction::Add;
+    // L'altro operando deve essere definito da un'operazione complementare
+    auto *DefBinOp = dyn_cast<BinaryOperator>(Inst.getOperand(1 - pos));
+    if (!DefBinOp || DefBinOp->getOpcode() != complOpt)
+      continue;
 
-    for (auto user = Inst.user_begin(); user != Inst.user_end(); user++) {
-      BinaryOperator *UserBinOp = dyn_cast<BinaryOperator>(*user);
-      if (!UserBinOp)
+    // Nella sottrazione la costante deve essere il secondo operando
+    // (𝑎 = 𝑏 - 1, 𝑐 = 𝑎 + 1), nell'addizione può stare in entrambe le
+    // posizioni.
+    for (int defPos = 0; defPos < 2; defPos++) {
+      // Le costanti sono uniche nel contesto: uguali se lo stesso puntatore
+      if (DefBinOp->getOperand(defPos) != IntOperand)
         continue;
 
-      for (auto userOperand = user->op_begin(); userOperand != user->op_end();
-           userOperand++) {
-        ConstantInt *userIntOperand = dyn_cast<ConstantInt>(userOperand);
-        if (userIntOperand && (userIntOperand->getValue() == IntVal &&
-                               UserBinOp->getOpcode() == complOpt)) {
-          user->replaceAllUsesWith(Inst.getOperand(1 - pos));
-          outs() << "Multi-Instruction Optimization\n";
-          Inst.print(outs());
-          outs() << "\n";
-          return true;
-        }
-      }
+      if ((OptType == Instruction::Sub && pos != 1) ||
+          (complOpt == Instruction::Sub && defPos != 1))
+        continue;
+
+      LLVM_DEBUG(dbgs() << "LocalOpts: " << Inst << " cancels " << *DefBinOp
+                        << "\n");
+      ++NumMultiInstruction;
+      Ctx.ORE.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, "MultiInstruction", &Inst)
+               << ore::NV("Opcode", Inst.getOpcodeName()) << " of "
+               << ore::NV("Constant", IntOperand) << " cancels the previous "
+               << ore::NV("Previous", DefBinOp->getOpcodeName());
+      });
+
+      Inst.replaceAllUsesWith(DefBinOp->getOperand(1 - defPos));
+      return true;
     }
   }
 
   return false;
 }
 
-bool runOnBasicBlock(BasicBlock &BB) {
-  bool Transformed = false;
+/**
+5. Reassociation
+  𝑎 = 𝑏 + 3, 𝑐 = 𝑎 + 5, 𝑑 = 𝑐 − 8   -> 𝑑 = 𝑏
+  𝑎 = 𝑏 + 4, 𝑐 = 𝑎 − 1             -> 𝑐 = 𝑏 + 3
+  𝑎 = 𝑏 ≪ 2, 𝑐 = 𝑎 × 3             -> 𝑐 = 𝑏 × 12
 
-  // Ciclo su tutte le istruzioni del blocco base
-  for (auto &Inst : BB) {
-    auto *BinOp = dyn_cast<BinaryOperator>(&Inst);
-    if (!BinOp)
-      continue;
+  Le catene di add/sub e di mul/shl per costante vengono appiattite seguendo
+  le definizioni degli operandi, anche attraverso blocchi diversi: ogni
+  definizione domina il suo uso, quindi le foglie dominano la radice e la
+  nuova catena può essere costruita subito prima di essa. Le costanti vengono
+  piegate in una sola e i termini opposti si annullano.
+  La catena viene ricostruita solo se non ha più istruzioni di quelle che
+  diventano morte; a parità, solo se salta un nodo intermedio con altri usi.
+*/
+enum class ChainKind { None, Additive, Multiplicative };
 
-    Instruction::BinaryOps Opcode = BinOp->getOpcode(); // Tipo di operazione
+ChainKind getChainKind(const Value *V) {
+  auto *BinOp = dyn_cast<BinaryOperator>(V);
+  if (!BinOp || !BinOp->getType()->isIntOrIntVectorTy())
+    return ChainKind::None;
 
-    switch (Opcode) {
-    case Instruction::Sub:
-    case Instruction::Add: {
-      if (multiInstructionOptimization(Inst, Opcode)) {
-        Transformed = true;
-        break;
-      }
-      outs() << "Instruction not multiInstructionOptimized \n";
-      Inst.print(outs());
-      outs() << "\n";
-      if (algebraicIdentity(Inst, Opcode)) {
-        Transformed = true;
-      }
+  switch (BinOp->getOpcode()) {
+  case Instruction::Add:
+  case Instruction::Sub:
+    return ChainKind::Additive;
+  case Instruction::Mul:
+    return ChainKind::Multiplicative;
+  case Instruction::Shl: {
+    // Solo la shift per costante è una moltiplicazione per 2^k
+    const APInt *Amount = getSplatConstant(BinOp->getOperand(1));
+    return Amount && Amount->ult(Amount->getBitWidth())
+               ? ChainKind::Multiplicative
+               : ChainKind::None;
+  }
+  default:
+    return ChainKind::None;
+  }
+}
 
-      break;
+// Numero massimo di nodi espansi per catena: nei DAG con nodi condivisi
+// l'appiattimento può crescere esponenzialmente. Oltre il limite i nodi
+// restanti diventano foglie e la catena viene riassociata lo stesso
+constexpr unsigned MaxChainNodes = 64;
+constexpr unsigned MaxReassociateRounds = 8;
+
+/**
+  Catena appiattita: Σ coefficiente × foglia + Constant per le catene
+  additive, Π fattori × Constant per quelle moltiplicative.
+*/
+struct FlatChain {
+  SmallVector<std::pair<Value *, APInt>, 8> Terms;
+  SmallVector<Value *, 8> Factors;
+  APInt Constant;
+  SetVector<Instruction *> Nodes;
+};
+
+// Profondità nell'albero dei dominatori della definizione di V: argomenti
+// e costanti vengono prima di tutto
+unsigned getDefinitionRank(Value *V, DominatorTree &DT) {
+  auto *Inst = dyn_cast<Instruction>(V);
+  if (!Inst)
+    return 0;
+  DomTreeNode *Node = DT.getNode(Inst->getParent());
+  return Node ? Node->getLevel() + 1 : 0;
+}
+
+bool flattenChain(Instruction &Root, ChainKind Kind, DominatorTree &DT,
+                  FlatChain &Chain) {
+  unsigned BitWidth = Root.getType()->getScalarSizeInBits();
+  Chain.Constant = APInt(BitWidth, Kind == ChainKind::Additive ? 0 : 1);
+  MapVector<Value *, APInt> Terms;
+
+  SmallVector<std::pair<Value *, APInt>, 16> Stack;
+  Stack.push_back({&Root, APInt(BitWidth, 1)});
+  unsigned Visited = 0;
+  bool HitLimit = false;
+
+  while (!Stack.empty()) {
+    auto [V, Coefficient] = Stack.pop_back_val();
+
+    if (const APInt *C = getSplatConstant(V)) {
+      if (Kind == ChainKind::Additive)
+        Chain.Constant += Coefficient * *C;
+      else
+        Chain.Constant *= *C;
+      continue;
     }
-    case Instruction::Mul: {
-      if (algebraicIdentity(Inst, Opcode) || strengthReduction(Inst, Opcode)) {
-        Transformed = true;
-      }
 
-      if (mutltipicationStrengthReduction(Inst, Opcode)) {
-        Transformed = true;
+    auto *Node = dyn_cast<BinaryOperator>(V);
+    bool IsLeaf = !Node || getChainKind(Node) != Kind;
+    if (!IsLeaf && Visited == MaxChainNodes) {
+      IsLeaf = true;
+      HitLimit = true;
+    }
+    if (IsLeaf) {
+      if (Kind == ChainKind::Additive) {
+        auto It = Terms.insert({V, APInt(BitWidth, 0)}).first;
+        It->second += Coefficient;
+      } else {
+        Chain.Factors.push_back(V);
       }
+      continue;
+    }
 
-      break;
+    ++Visited;
+    Chain.Nodes.insert(Node);
+
+    // L'ordine di inserimento fa visitare prima l'operando 0
+    if (Node->getOpcode() == Instruction::Shl) {
+      Chain.Constant <<= getSplatConstant(Node->getOperand(1))->getZExtValue();
+      Stack.push_back({Node->getOperand(0), Coefficient});
+      continue;
     }
-    case Instruction::UDiv:
-    case Instruction::SDiv: {
-      if (strengthReduction(Inst, Opcode) || algebraicIdentity(Inst, Opcode)) {
-        Transformed = true;
-      }
 
-      if (mutltipicationStrengthReduction(Inst, Opcode)) {
-        Transformed = true;
+    Stack.push_back({Node->getOperand(1), Node->getOpcode() == Instruction::Sub
+                                              ? -Coefficient
+                                              : Coefficient});
+    Stack.push_back({Node->getOperand(0), Coefficient});
+  }
+
+  // Un nodo condiviso espanso prima del limite può essere anche una foglia
+  // raggiunta dopo: resta usato dalla nuova catena e non diventa morto
+  if (HitLimit) {
+    Chain.Nodes.remove_if([&](Instruction *Node) {
+      return Terms.count(Node) || is_contained(Chain.Factors, Node);
+    });
+  }
+
+  // I termini che si annullano spariscono; gli altri sono ordinati per
+  // profondità della definizione, così che i termini invarianti rispetto a
+  // un loop formino il prefisso della nuova catena
+  for (auto &[Leaf, Coefficient] : Terms) {
+    if (!Coefficient.isZero())
+      Chain.Terms.push_back({Leaf, Coefficient});
+  }
+  stable_sort(Chain.Terms, [&](const auto &LHS, const auto &RHS) {
+    return getDefinitionRank(LHS.first, DT) < getDefinitionRank(RHS.first, DT);
+  });
+  stable_sort(Chain.Factors, [&](Value *LHS, Value *RHS) {
+    return getDefinitionRank(LHS, DT) < getDefinitionRank(RHS, DT);
+  });
+
+  return true;
+}
+
+// Nodi della catena che diventano morti sostituendo la radice: quelli i cui
+// utenti sono tutti nodi morti
+SmallPtrSet<Instruction *, 16> getDyingNodes(Instruction &Root,
+                                             const FlatChain &Chain) {
+  SmallPtrSet<Instruction *, 16> Dying;
+  Dying.insert(&Root);
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (Instruction *Node : Chain.Nodes) {
+      if (Dying.count(Node))
+        continue;
+
+      if (all_of(Node->users(), [&](User *U) {
+            auto *UserInst = dyn_cast<Instruction>(U);
+            return UserInst && Dying.count(UserInst);
+          })) {
+        Dying.insert(Node);
+        Changed = true;
       }
-      break;
     }
-    default:
-      break;
+  }
+
+  return Dying;
+}
+
+// Numero di istruzioni necessarie per ricostruire la catena
+unsigned getRebuiltSize(ChainKind Kind, const FlatChain &Chain) {
+  unsigned Size = 0;
+  bool HasAccumulator = false;
+
+  if (Kind == ChainKind::Multiplicative) {
+    if (Chain.Constant.isZero() || Chain.Factors.empty())
+      return 0;
+    return Chain.Factors.size() - 1 + (Chain.Constant.isOne() ? 0 : 1);
+  }
+
+  for (const auto &[Leaf, Coefficient] : Chain.Terms) {
+    bool IsUnit = Coefficient.isOne() || Coefficient.isAllOnes();
+    // Il primo termine con coefficiente 1 non costa nulla; gli altri
+    // richiedono una add/sub, più una mul se il coefficiente non è ±1
+    if (!HasAccumulator)
+      Size += Coefficient.isOne() ? 0 : 1;
+    else
+      Size += IsUnit ? 1 : 2;
+    HasAccumulator = true;
+  }
+
+  if (!Chain.Constant.isZero() && HasAccumulator)
+    Size++;
+
+  return Size;
+}
+
+Value *rebuildChain(IRBuilder<> &Builder, Type *Ty, ChainKind Kind,
+                    const FlatChain &Chain) {
+  if (Kind == ChainKind::Multiplicative) {
+    if (Chain.Constant.isZero() || Chain.Factors.empty())
+      return ConstantInt::get(Ty, Chain.Constant);
+
+    // La costante viene applicata al primo fattore, il più invariante
+    Value *Result = Chain.Factors.front();
+    if (!Chain.Constant.isOne())
+      Result = Builder.CreateMul(Result, ConstantInt::get(Ty, Chain.Constant));
+    for (Value *Factor : drop_begin(Chain.Factors))
+      Result = Builder.CreateMul(Result, Factor);
+    return Result;
+  }
+
+  if (Chain.Terms.empty())
+    return ConstantInt::get(Ty, Chain.Constant);
+
+  // Come per i fattori, la costante viene sommata al primo termine
+  Value *Result = nullptr;
+  for (const auto &[Leaf, Coefficient] : Chain.Terms) {
+    if (!Result) {
+      Result = Coefficient.isOne()       ? Leaf
+               : Coefficient.isAllOnes() ? Builder.CreateNeg(Leaf)
+                                         : Builder.CreateMul(
+                                               Leaf,
+                                               ConstantInt::get(Ty, Coefficient));
+      if (!Chain.Constant.isZero())
+        Result =
+            Builder.CreateAdd(Result, ConstantInt::get(Ty, Chain.Constant));
+    } else if (Coefficient.isOne()) {
+      Result = Builder.CreateAdd(Result, Leaf);
+    } else if (Coefficient.isAllOnes()) {
+      Result = Builder.CreateSub(Result, Leaf);
+    } else {
+      Result = Builder.CreateAdd(
+          Result, Builder.CreateMul(Leaf, ConstantInt::get(Ty, Coefficient)));
     }
-    outs() << "Instruction\n";
-    Inst.print(outs());
-    outs() << "\n---------------------------------------------\n";
   }
 
-  // Rimuove le operazioni binarie senza utilizzi
-  for (auto Inst = BB.begin(); Inst != BB.end(); Inst++) {
-    BinaryOperator *BinOp = dyn_cast<BinaryOperator>(Inst);
-    if (BinOp && Inst->hasNUses(0)) {
-      Inst = Inst->eraseFromParent();
-      Inst--;
+  return Result;
+}
+
+bool reassociateChain(Instruction &Root, ChainKind Kind, DominatorTree &DT,
+                      OptimizationRemarkEmitter &ORE) {
+  FlatChain Chain;
+  if (!flattenChain(Root, Kind, DT, Chain))
+    return false;
+
+  auto Dying = getDyingNodes(Root, Chain);
+  unsigned OldSize = Dying.size();
+  unsigned NewSize = getRebuiltSize(Kind, Chain);
+  bool SkipsSharedNode = Dying.size() != Chain.Nodes.size();
+
+  if (NewSize > OldSize || (NewSize == OldSize && !SkipsSharedNode))
+    return false;
+
+  IRBuilder<> Builder(&Root);
+  Value *Result = rebuildChain(Builder, Root.getType(), Kind, Chain);
+
+  LLVM_DEBUG(dbgs() << "LocalOpts: reassociated " << Root << " -> " << *Result
+                    << "\n");
+  ++NumReassociated;
+  ORE.emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "Reassociated", &Root)
+           << "chain of " << ore::NV("OldSize", OldSize)
+           << " instructions reassociated into "
+           << ore::NV("NewSize", NewSize);
+  });
+
+  Root.replaceAllUsesWith(Result);
+  RecursivelyDeleteTriviallyDeadInstructions(&Root);
+  return true;
+}
+
+// Un nodo con un solo uso da parte di un nodo della stessa catena viene
+// gestito insieme alla radice della catena
+bool isChainRoot(const Instruction &Inst, ChainKind Kind) {
+  if (!Inst.hasOneUse())
+    return true;
+  return getChainKind(*Inst.user_begin()) != Kind;
+}
+
+// Visita le istruzioni in preordine sull'albero dei dominatori, così che
+// le definizioni vengano semplificate prima dei loro usi
+bool reassociateOnce(Function &F, DominatorTree &DT,
+                         OptimizationRemarkEmitter &ORE) {
+  SmallVector<WeakTrackingVH, 64> Roots;
+  for (DomTreeNode *Node : depth_first(DT.getRootNode())) {
+    for (Instruction &Inst : *Node->getBlock()) {
+      ChainKind Kind = getChainKind(&Inst);
+      if (Kind != ChainKind::None && isChainRoot(Inst, Kind))
+        Roots.push_back(&Inst);
     }
   }
 
-  outs() << "Basic block is trasformed: " << Transformed << "\n";
+  bool Transformed = false;
+  for (WeakTrackingVH &Handle : Roots) {
+    // La radice potrebbe essere stata cancellata come nodo morto; quelle
+    // già morte vengono lasciate al motore di riscrittura
+    auto *Root = dyn_cast_or_null<Instruction>(Handle);
+    if (!Root || isInstructionTriviallyDead(Root))
+      continue;
+
+    Transformed |= reassociateChain(*Root, getChainKind(Root), DT, ORE);
+  }
+
   return Transformed;
 }
 
-bool runOnFunction(Function &F) {
-  bool Transformed = false;
+// Riscrivere una catena può lasciare un solo uso a un nodo condiviso, che
+// al giro successivo può essere assorbito dai suoi utenti: si ripete finché
+// ci sono cambiamenti, con un limite per sicurezza
+bool reassociateFunction(Function &F, DominatorTree &DT,
+                         OptimizationRemarkEmitter &ORE) {
+  // Gli utenti morti impedirebbero di assorbire i nodi condivisi: vengono
+  // cancellati prima di appiattire le catene
+  SmallVector<WeakTrackingVH, 16> DeadInsts;
+  for (Instruction &Inst : instructions(F)) {
+    if (isInstructionTriviallyDead(&Inst))
+      DeadInsts.push_back(&Inst);
+  }
+  bool Transformed = RecursivelyDeleteTriviallyDeadInstructionsPermissive(
+      DeadInsts);
 
-  for (auto Iter = F.begin(); Iter != F.end(); ++Iter) {
-    if (runOnBasicBlock(*Iter)) {
+  for (unsigned i = 0; i < MaxReassociateRounds; i++) {
+    if (!reassociateOnce(F, DT, ORE))
+      break;
+    Transformed = true;
+  }
+
+  return Transformed;
+}
+
+/**
+  Worklist usata dal motore di riscrittura.
+  Le istruzioni vengono estratte in ordine LIFO; il set tiene traccia di
+  quelle ancora in coda così da non inserirle due volte e da poterle
+  rimuovere in O(1) quando vengono cancellate.
+*/
+class LocalOptsWorklist {
+  SmallVector<Instruction *, 256> List;
+  SmallPtrSet<Instruction *, 32> InList;
+
+public:
+  bool empty() const { return InList.empty(); }
+
+  void push(Instruction *Inst) {
+    if (InList.insert(Inst).second)
+      List.push_back(Inst);
+  }
+
+  void remove(Instruction *Inst) { InList.erase(Inst); }
+
+  Instruction *pop() {
+    while (!List.empty()) {
+      Instruction *Inst = List.pop_back_val();
+      // Le istruzioni rimosse restano nel vettore ma non nel set
+      if (InList.erase(Inst))
+        return Inst;
+    }
+    return nullptr;
+  }
+};
+
+// Predicati sugli operandi: filtri economici valutati prima della regola
+bool hasConstantOperand(const Instruction &Inst) {
+  return isa<Constant>(Inst.getOperand(0)) || isa<Constant>(Inst.getOperand(1));
+}
+
+bool hasConstantDivisor(const Instruction &Inst) {
+  return isa<Constant>(Inst.getOperand(1));
+}
+
+/**
+  Regola di riscrittura: opcode a cui si applica, predicato sugli operandi e
+  funzione che costruisce la sostituzione.
+*/
+struct LocalOptsRule {
+  Instruction::BinaryOps Opcode;
+  bool (*Matches)(const Instruction &);
+  bool (*Apply)(Instruction &, Instruction::BinaryOps, const RuleContext &);
+};
+
+/**
+  Tabella delle regole. Le regole dello stesso opcode devono essere contigue
+  e vengono provate nell'ordine della tabella: la prima che ha successo
+  sostituisce l'istruzione. Per aggiungere una regola basta una riga.
+*/
+constexpr LocalOptsRule Rules[] = {
+    {Instruction::Add, hasConstantOperand, multiInstructionOptimization},
+    {Instruction::Add, hasConstantOperand, algebraicIdentity},
+    {Instruction::Sub, hasConstantOperand, multiInstructionOptimization},
+    {Instruction::Sub, hasConstantOperand, algebraicIdentity},
+    {Instruction::Mul, hasConstantOperand, algebraicIdentity},
+    {Instruction::Mul, hasConstantOperand, mutltipicationStrengthReduction},
+    {Instruction::Mul, hasConstantOperand, strengthReduction},
+    {Instruction::UDiv, hasConstantDivisor, algebraicIdentity},
+    {Instruction::UDiv, hasConstantDivisor, divisionStrengthReduction},
+    {Instruction::SDiv, hasConstantDivisor, algebraicIdentity},
+    {Instruction::SDiv, hasConstantDivisor, divisionStrengthReduction},
+    {Instruction::URem, hasConstantDivisor, divisionStrengthReduction},
+    {Instruction::SRem, hasConstantDivisor, divisionStrengthReduction},
+};
+
+constexpr unsigned NumBinaryOps =
+    Instruction::BinaryOpsEnd - Instruction::BinaryOpsBegin;
+
+// Intervallo [Begin, End) della tabella con le regole di un opcode
+struct RuleRange {
+  unsigned Begin = 0;
+  unsigned End = 0;
+};
+
+// Dispatch indicizzato per opcode, calcolato a tempo di compilazione
+constexpr std::array<RuleRange, NumBinaryOps> buildRuleDispatch() {
+  std::array<RuleRange, NumBinaryOps> Dispatch{};
+  for (unsigned i = 0; i < std::size(Rules); i++) {
+    RuleRange &Range = Dispatch[Rules[i].Opcode - Instruction::BinaryOpsBegin];
+    if (Range.Begin == Range.End)
+      Range.Begin = i;
+    Range.End = i + 1;
+  }
+  return Dispatch;
+}
+
+constexpr std::array<RuleRange, NumBinaryOps> RuleDispatch =
+    buildRuleDispatch();
+
+// Verifica che le regole di ogni opcode siano contigue nella tabella
+constexpr bool areRulesGrouped() {
+  for (unsigned i = 0; i < std::size(Rules); i++) {
+    const RuleRange &Range =
+        RuleDispatch[Rules[i].Opcode - Instruction::BinaryOpsBegin];
+    if (i < Range.Begin || i >= Range.End)
+      return false;
+    for (unsigned j = Range.Begin; j < Range.End; j++) {
+      if (Rules[j].Opcode != Rules[i].Opcode)
+        return false;
+    }
+  }
+  return true;
+}
+
+static_assert(areRulesGrouped(),
+              "LocalOpts rules for the same opcode must be contiguous");
+
+/**
+  Prova le regole di riscrittura sull'istruzione.
+  Ogni regola che ha successo sostituisce tutti gli usi di Inst, che quindi
+  diventa dead code e verrà rimossa dal motore.
+*/
+bool optimizeInstruction(Instruction &Inst, const RuleContext &Ctx) {
+  auto *BinOp = dyn_cast<BinaryOperator>(&Inst);
+  if (!BinOp)
+    return false;
+
+  Instruction::BinaryOps Opcode = BinOp->getOpcode(); // Tipo di operazione
+  const RuleRange &Range =
+      RuleDispatch[Opcode - Instruction::BinaryOpsBegin];
+
+  for (unsigned i = Range.Begin; i < Range.End; i++) {
+    const LocalOptsRule &Rule = Rules[i];
+    if (Rule.Matches(Inst) && Rule.Apply(Inst, Opcode, Ctx))
+      return true;
+  }
+
+  return false;
+}
+
+// Cancella un'istruzione morta e rimette in coda i suoi operandi, che
+// potrebbero essere diventati a loro volta dead code.
+void eraseDeadInstruction(Instruction &Inst, LocalOptsWorklist &Worklist) {
+  for (Use &Operand : Inst.operands()) {
+    if (auto *OpInst = dyn_cast<Instruction>(Operand))
+      Worklist.push(OpInst);
+  }
+
+  Worklist.remove(&Inst);
+  Inst.eraseFromParent();
+  ++NumDeadErased;
+}
+
+// Motore di riscrittura a punto fisso: dopo la riassociazione ogni
+// istruzione viene visitata e, dopo ogni sostituzione, i suoi utenti e le
+// nuove istruzioni vengono rimessi in coda finché non ci sono più
+// cambiamenti.
+bool runOnFunction(Function &F, const TargetTransformInfo &TTI,
+                   DominatorTree &DT, OptimizationRemarkEmitter &ORE) {
+  bool Transformed = Reassociate && reassociateFunction(F, DT, ORE);
+  RuleContext Ctx{TTI, ORE};
+  LocalOptsWorklist Worklist;
+
+  // Inserisco le istruzioni in ordine inverso così che vengano estratte
+  // nell'ordine del programma
+  for (BasicBlock &BB : reverse(F)) {
+    for (Instruction &Inst : reverse(BB)) {
+      Worklist.push(&Inst);
+    }
+  }
+
+  while (Instruction *Inst = Worklist.pop()) {
+    if (isInstructionTriviallyDead(Inst)) {
+      eraseDeadInstruction(*Inst, Worklist);
       Transformed = true;
-      outs() << "++ Function is trasformed\n";
+      continue;
+    }
+
+    // Gli utenti vanno salvati prima della sostituzione
+    SmallVector<Instruction *, 8> Users;
+    for (User *U : Inst->users()) {
+      if (auto *UserInst = dyn_cast<Instruction>(U))
+        Users.push_back(UserInst);
+    }
+    Instruction *Next = Inst->getNextNode();
+
+    if (!optimizeInstruction(*Inst, Ctx))
+      continue;
+
+    Transformed = true;
+
+    // Le regole inseriscono le nuove istruzioni subito dopo Inst
+    for (Instruction *NewInst = Inst->getNextNode(); NewInst != Next;
+         NewInst = NewInst->getNextNode()) {
+      Worklist.push(NewInst);
     }
+
+    for (Instruction *UserInst : Users) {
+      Worklist.push(UserInst);
+    }
+
+    // Inst non ha più usi: verrà cancellata alla prossima estrazione
+    Worklist.push(Inst);
   }
 
+  if (Transformed)
+    LLVM_DEBUG(dbgs() << "LocalOpts: transformed " << F.getName() << "\n");
+
   return Transformed;
 }
 
 PreservedAnalyses LocalOpts::run(Module &M, ModuleAnalysisManager &AM) {
   bool Transformed = false;
+  FunctionAnalysisManager &FAM =
+      AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
   for (auto Fiter = M.begin(); Fiter != M.end(); ++Fiter) {
-    if (runOnFunction(*Fiter)) {
+    if (Fiter->isDeclaration())
+      continue;
+
+    TargetTransformInfo &TTI = FAM.getResult<TargetIRAnalysis>(*Fiter);
+    auto &DT = FAM.getResult<DominatorTreeAnalysis>(*Fiter);
+    auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(*Fiter);
+    if (runOnFunction(*Fiter, TTI, DT, ORE)) {
       Transformed = true;
-      outs() << "+++ Module is trasformed\n";
     }
   }
 
@@ -80,4 +80,226 @@ entry:
   %a = add i32 %b, 7
   %c = sub i32 %a, 7
   ret i32 %c
-}
\ No newline at end of file
+}
+
+; Function to test rewrites that enable other rewrites (fixed point)
+; a = x * 1
+; b = a + 3
+; c = b - 3
+; d = c * 1
+define i32 @chained_optimizations(i32 %x) {
+entry:
+  %a = mul i32 %x, 1
+  %b = add i32 %a, 3
+  %c = sub i32 %b, 3
+  %d = mul i32 %c, 1
+  ret i32 %d
+}
+
+; Function to test signed division by a negative power of 2 (e.g., x / -8)
+define i32 @divide_by_minus_eight(i32 %x) {
+entry:
+  %result = sdiv i32 %x, -8
+  ret i32 %result
+}
+
+; Function to test remainder by a power of 2 (e.g., x urem 16, x srem 16)
+define i32 @remainder_by_sixteen(i32 %x) {
+entry:
+  %a = urem i32 %x, 16
+  %b = srem i32 %x, 16
+  %result = add i32 %a, %b
+  ret i32 %result
+}
+
+; Function to test division by arbitrary constants (-localopts-magic-div)
+; e.g., x udiv 7, x sdiv -3, x srem 10
+define i32 @divide_by_constants(i32 %x) {
+entry:
+  %a = udiv i32 %x, 7
+  %b = sdiv i32 %x, -3
+  %c = srem i32 %x, 10
+  %d = add i32 %a, %b
+  %result = add i32 %d, %c
+  ret i32 %result
+}
+
+; Function to test shift/add decomposition of arbitrary constants
+; (x * 10, x * 45, x * -7), emitted only when cheaper than a mul
+define i32 @multiply_by_constants(i32 %x) {
+entry:
+  %a = mul i32 %x, 10
+  %b = mul i32 45, %x
+  %c = mul i32 %x, -7
+  %d = add i32 %a, %b
+  %result = add i32 %d, %c
+  ret i32 %result
+}
+
+; Function to test negative even constants: the odd part is decomposed on
+; the bits left after the final shift (x * -8 -> 0 - (x << 3),
+; x * -24 -> (x - (x << 2)) << 3)
+define i32 @multiply_by_negative_even(i32 %x) {
+entry:
+  %a = mul i32 %x, -8
+  %b = mul i32 %x, -24
+  %result = add i32 %a, %b
+  ret i32 %result
+}
+
+; Function to test vector operations with splat constants
+; a = v * <8, 8, 8, 8>, b = a + <0, 0, 0, 0>, c = b udiv <4, 4, 4, 4>
+define <4 x i32> @vector_splat(<4 x i32> %v) {
+entry:
+  %a = mul <4 x i32> %v, <i32 8, i32 8, i32 8, i32 8>
+  %b = add <4 x i32> %a, zeroinitializer
+  %c = udiv <4 x i32> %b, <i32 4, i32 4, i32 4, i32 4>
+  ret <4 x i32> %c
+}
+
+; Function to test vector operations with a different constant in every lane
+; a = v * <2, 4, 8, 16>, b = a + <1, 2, 3, 4>, c = b - <1, 2, 3, 4>
+define <4 x i32> @vector_per_lane(<4 x i32> %v) {
+entry:
+  %a = mul <4 x i32> %v, <i32 2, i32 4, i32 8, i32 16>
+  %b = add <4 x i32> %a, <i32 1, i32 2, i32 3, i32 4>
+  %c = sub <4 x i32> %b, <i32 1, i32 2, i32 3, i32 4>
+  ret <4 x i32> %c
+}
+
+; Function to test reassociation of constant chains across basic blocks
+; b + 3 + 5 - 8 -> b, (b + 4) - 1 -> b + 3 with b + 4 still used,
+; ((b << 2) * 3) in the loop -> b * 12
+define i32 @reassociate_chains(i32 %b, i32 %n) {
+entry:
+  %a = add i32 %b, 3
+  %a4 = add i32 %b, 4
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  %c = add i32 %a, 5
+  %d = sub i32 %c, 8
+  %e = sub i32 %a4, 1
+  %s = shl i32 %b, 2
+  %m = mul i32 %s, 3
+  %t0 = add i32 %acc, %d
+  %t1 = add i32 %t0, %e
+  %t2 = add i32 %t1, %m
+  %acc.next = add i32 %t2, %a4
+  %i.next = add i32 %i, 1
+  %cond = icmp slt i32 %i.next, %n
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  ret i32 %acc.next
+}
+
+; Function to test a chain longer than the 64 nodes expanded at once:
+; 99 adds of %x, %y and 2. The nodes past the limit become leaves and are
+; reassociated in the next round, so the chain is not dropped and folds into
+; (x * 13 + 66 + y * 12) + y * 21 + x * 21 = x * 34 + y * 33 + 66
+define i32 @reassociate_long_chain(i32 %x, i32 %y) {
+entry:
+  %c1 = add i32 %x, %y
+  %c2 = add i32 %c1, %x
+  %c3 = add i32 %c2, 2
+  %c4 = add i32 %c3, %x
+  %c5 = add i32 %c4, %y
+  %c6 = add i32 %c5, 2
+  %c7 = add i32 %c6, %y
+  %c8 = add i32 %c7, %x
+  %c9 = add i32 %c8, 2
+  %c10 = add i32 %c9, %x
+  %c11 = add i32 %c10, %y
+  %c12 = add i32 %c11, 2
+  %c13 = add i32 %c12, %y
+  %c14 = add i32 %c13, %x
+  %c15 = add i32 %c14, 2
+  %c16 = add i32 %c15, %x
+  %c17 = add i32 %c16, %y
+  %c18 = add i32 %c17, 2
+  %c19 = add i32 %c18, %y
+  %c20 = add i32 %c19, %x
+  %c21 = add i32 %c20, 2
+  %c22 = add i32 %c21, %x
+  %c23 = add i32 %c22, %y
+  %c24 = add i32 %c23, 2
+  %c25 = add i32 %c24, %y
+  %c26 = add i32 %c25, %x
+  %c27 = add i32 %c26, 2
+  %c28 = add i32 %c27, %x
+  %c29 = add i32 %c28, %y
+  %c30 = add i32 %c29, 2
+  %c31 = add i32 %c30, %y
+  %c32 = add i32 %c31, %x
+  %c33 = add i32 %c32, 2
+  %c34 = add i32 %c33, %x
+  %c35 = add i32 %c34, %y
+  %c36 = add i32 %c35, 2
+  %c37 = add i32 %c36, %y
+  %c38 = add i32 %c37, %x
+  %c39 = add i32 %c38, 2
+  %c40 = add i32 %c39, %x
+  %c41 = add i32 %c40, %y
+  %c42 = add i32 %c41, 2
+  %c43 = add i32 %c42, %y
+  %c44 = add i32 %c43, %x
+  %c45 = add i32 %c44, 2
+  %c46 = add i32 %c45, %x
+  %c47 = add i32 %c46, %y
+  %c48 = add i32 %c47, 2
+  %c49 = add i32 %c48, %y
+  %c50 = add i32 %c49, %x
+  %c51 = add i32 %c50, 2
+  %c52 = add i32 %c51, %x
+  %c53 = add i32 %c52, %y
+  %c54 = add i32 %c53, 2
+  %c55 = add i32 %c54, %y
+  %c56 = add i32 %c55, %x
+  %c57 = add i32 %c56, 2
+  %c58 = add i32 %c57, %x
+  %c59 = add i32 %c58, %y
+  %c60 = add i32 %c59, 2
+  %c61 = add i32 %c60, %y
+  %c62 = add i32 %c61, %x
+  %c63 = add i32 %c62, 2
+  %c64 = add i32 %c63, %x
+  %c65 = add i32 %c64, %y
+  %c66 = add i32 %c65, 2
+  %c67 = add i32 %c66, %y
+  %c68 = add i32 %c67, %x
+  %c69 = add i32 %c68, 2
+  %c70 = add i32 %c69, %x
+  %c71 = add i32 %c70, %y
+  %c72 = add i32 %c71, 2
+  %c73 = add i32 %c72, %y
+  %c74 = add i32 %c73, %x
+  %c75 = add i32 %c74, 2
+  %c76 = add i32 %c75, %x
+  %c77 = add i32 %c76, %y
+  %c78 = add i32 %c77, 2
+  %c79 = add i32 %c78, %y
+  %c80 = add i32 %c79, %x
+  %c81 = add i32 %c80, 2
+  %c82 = add i32 %c81, %x
+  %c83 = add i32 %c82, %y
+  %c84 = add i32 %c83, 2
+  %c85 = add i32 %c84, %y
+  %c86 = add i32 %c85, %x
+  %c87 = add i32 %c86, 2
+  %c88 = add i32 %c87, %x
+  %c89 = add i32 %c88, %y
+  %c90 = add i32 %c89, 2
+  %c91 = add i32 %c90, %y
+  %c92 = add i32 %c91, %x
+  %c93 = add i32 %c92, 2
+  %c94 = add i32 %c93, %x
+  %c95 = add i32 %c94, %y
+  %c96 = add i32 %c95, 2
+  %c97 = add i32 %c96, %y
+  %c98 = add i32 %c97, %x
+  %c99 = add i32 %c98, 2
+  ret i32 %c99
+}
@@ -9,12 +9,74 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Utils/LICMZ.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopAccessAnalysis.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/MemorySSAUpdater.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/LoopVersioning.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+
+#include <optional>
 
 using namespace llvm;
 
-bool isInstructionInvariant(const Instruction &Inst, Loop &L);
+#define DEBUG_TYPE "licmz"
+
+STATISTIC(NumHoisted, "Number of instructions hoisted to the preheader");
+STATISTIC(NumNotInvariant, "Number of instructions not loop invariant");
+STATISTIC(NumLoadsHoisted, "Number of loads hoisted to the preheader");
+STATISTIC(NumHoistedOutOfNest,
+          "Number of instructions hoisted out of more than one loop");
+STATISTIC(NumSunk, "Number of instructions sunk into the exit blocks");
+STATISTIC(NumPromoted, "Number of memory locations promoted to registers");
+STATISTIC(NumVersioned, "Number of loops versioned with runtime alias checks");
+STATISTIC(NumNotHoistable,
+          "Number of invariant instructions that cannot be moved");
+STATISTIC(NumNotSafeToSpeculate,
+          "Number of invariant instructions not hoisted because they could "
+          "trap on a path that does not execute them");
+STATISTIC(NumOperandNotHoisted,
+          "Number of invariant instructions not hoisted because an operand "
+          "stays in the loop");
+STATISTIC(NumNotProfitable,
+          "Number of invariant instructions not hoisted because their block "
+          "runs less often than the preheader");
+STATISTIC(NumNotDominatingExits,
+          "Number of invariant instructions not dominating the exits and "
+          "used after the loop");
+
+static cl::opt<bool> UseBlockFrequency(
+    "licmz-block-frequency", cl::init(true), cl::Hidden,
+    cl::desc("Hoist only when the instruction's block runs more often than "
+             "the preheader, according to BlockFrequencyInfo"));
+
+static cl::opt<bool> Versioning(
+    "licmz-versioning", cl::init(false), cl::Hidden,
+    cl::desc("Version loops whose invariant loads are blocked by stores that "
+             "may alias, guarding the copy with runtime overlap checks"));
+
+static cl::opt<unsigned> VersioningMaxChecks(
+    "licmz-versioning-max-checks", cl::init(8), cl::Hidden,
+    cl::desc("Maximum number of runtime pointer checks for loop versioning"));
+
+// Stesso metadato di LoopVersioningLICM: evita di duplicare di nuovo le
+// due copie del loop
+static const char *VersioningDisabled = "llvm.loop.licm_versioning.disable";
 
-bool isOperandInvariant(const Use &Usee, Loop &L) {
+bool isOperandInvariant(const Use &Usee, Loop &L,
+                        const SmallPtrSetImpl<Instruction *> &Invariants) {
   // Se è una costante o un argomento di funzione è invariante
   if (isa<Constant>(Usee) || isa<Argument>(Usee)) {
     return true;
@@ -22,19 +84,28 @@ bool isOperandInvariant(const Use &Usee, Loop &L) {
 
   Instruction *Inst = dyn_cast<Instruction>(Usee);
 
-  if (!Inst || isa<PHINode>(Inst)) {
+  if (!Inst) {
     return false;
   }
 
-  // Se la reaching definition è fuori dal loop allora è invariante
+  // Se la reaching definition è fuori dal loop allora è invariante, anche
+  // se è un phi-node (ad esempio l'induzione di un loop esterno)
   if (!L.contains(Inst)) {
     return true;
   }
 
-  return L.isLoopInvariant(Inst);
+  if (isa<PHINode>(Inst)) {
+    return false;
+  }
+
+  // Altrimenti deve essere già stata riconosciuta come invariante: la
+  // visita in preordine sui dominatori incontra le definizioni prima degli
+  // usi
+  return Invariants.count(Inst);
 }
 
-bool isInstructionInvariant(const Instruction &Inst, Loop &L) {
+bool isInstructionInvariant(const Instruction &Inst, Loop &L,
+                            const SmallPtrSetImpl<Instruction *> &Invariants) {
   // Se è un phi-node non è invariante
   if (isa<PHINode>(Inst)) {
     return false;
@@ -43,7 +114,7 @@ bool isInstructionInvariant(const Instruction &Inst, Loop &L) {
   // Verifica se tutti gli operandi sono invariabili
   for (const auto &Usee : Inst.operands()) {
     // Se un'operando non è invariante allora l'istruzione non è invariante
-    if (!isOperandInvariant(Usee, L)) {
+    if (!isOperandInvariant(Usee, L, Invariants)) {
       return false;
     }
   }
@@ -63,15 +134,15 @@ bool isDeadCode(const Instruction &Inst, Loop &L) {
   return true;
 }
 
-bool isInstructionDominatedByExits(
-    const Instruction &Inst,
+bool isBlockDominatingExits(
+    const BasicBlock *BB,
     const SmallVector<std::pair<BasicBlock *, BasicBlock *>> &ExitBasicBlocks,
     const DominatorTree &DT) {
-  // Controlla se l'istruzione domina tutte le uscite
+  // Controlla se il blocco domina tutte le uscite
   for (const auto &ExitBasicBlock : ExitBasicBlocks) {
-    // Controlla che l'istruzione domini il blocco(second) fuori dal loop
+    // Controlla che il blocco domini il blocco(second) fuori dal loop
     // verso cui punta l'arco di uscita
-    if (!DT.dominates(&Inst, ExitBasicBlock.second)) {
+    if (!DT.dominates(BB, ExitBasicBlock.second)) {
       return false;
     }
   }
@@ -80,68 +151,709 @@ bool isInstructionDominatedByExits(
   return true;
 }
 
+// I blocchi di uscita sono fuori dal loop, quindi un'istruzione del loop li
+// domina se e solo se li domina il suo blocco
+bool isInstructionDominatedByExits(
+    const Instruction &Inst,
+    const SmallVector<std::pair<BasicBlock *, BasicBlock *>> &ExitBasicBlocks,
+    const DominatorTree &DT) {
+  return isBlockDominatingExits(Inst.getParent(), ExitBasicBlocks, DT);
+}
+
+// Una load è invariante se nessuna scrittura nel loop può modificare la
+// locazione letta: secondo MemorySSA il suo clobber è fuori dal loop.
+// Senza MemorySSA si interroga l'alias analysis su ogni scrittura del loop.
+bool isLoadInvariant(LoadInst &Load, Loop &L, MemorySSA *MSSA,
+                     AAResults &AA) {
+  if (!Load.isSimple())
+    return false;
+
+  if (!MSSA) {
+    MemoryLocation Loc = MemoryLocation::get(&Load);
+    for (auto *BB : L.getBlocks()) {
+      for (auto &Inst : *BB) {
+        if (Inst.mayWriteToMemory() && isModSet(AA.getModRefInfo(&Inst, Loc)))
+          return false;
+      }
+    }
+    return true;
+  }
+
+  auto *Access = MSSA->getMemoryAccess(&Load);
+  if (!Access)
+    return false;
+
+  MemoryAccess *Clobber =
+      MSSA->getWalker()->getClobberingMemoryAccess(Access);
+  return MSSA->isLiveOnEntryDef(Clobber) || !L.contains(Clobber->getBlock());
+}
+
+// Controlla se l'istruzione può essere spostata nel preheader: niente
+// effetti collaterali e, per le load, nessun clobber nel loop.
+bool canHoistInstruction(Instruction &Inst, Loop &L, MemorySSA *MSSA,
+                         AAResults &AA) {
+  if (auto *Load = dyn_cast<LoadInst>(&Inst))
+    return isLoadInvariant(*Load, L, MSSA, AA);
+
+  if (auto *Call = dyn_cast<CallBase>(&Inst))
+    return Call->doesNotAccessMemory() && isSafeToSpeculativelyExecute(Call);
+
+  return isa<BinaryOperator, UnaryOperator, CastInst, CmpInst, SelectInst,
+             GetElementPtrInst, ExtractElementInst, InsertElementInst,
+             ShuffleVectorInst, ExtractValueInst, InsertValueInst,
+             FreezeInst>(Inst);
+}
+
+/**
+  Risale il nido di loop a partire da L: l'istruzione può salire di un
+  livello se i suoi operandi sono definiti fuori dal loop padre, se (per le
+  load) nessuna scrittura del padre modifica la locazione e se viene
+  comunque eseguita a ogni iterazione del padre, oppure non può causare
+  trap. Restituisce il loop più esterno nel cui preheader va spostata.
+  Con le frequenze dei blocchi viene scelto, tra i livelli raggiungibili, il
+  preheader eseguito meno spesso: se il loop interno sta su un ramo
+  raramente eseguito, il preheader di un loop esterno può essere più caldo.
+*/
+Loop *getOutermostHoistLoop(Instruction &Inst, Loop &L,
+                            LoopStandardAnalysisResults &LAR,
+                            const BlockFrequencyInfo *BFI) {
+  Loop *Target = &L;
+  Loop *Coldest = &L;
+
+  while (Loop *Parent = Target->getParentLoop()) {
+    if (!Parent->getLoopPreheader() ||
+        !Parent->hasLoopInvariantOperands(&Inst))
+      break;
+
+    if (auto *Load = dyn_cast<LoadInst>(&Inst);
+        Load && !isLoadInvariant(*Load, *Parent, LAR.MSSA, LAR.AA))
+      break;
+
+    SmallVector<std::pair<BasicBlock *, BasicBlock *>> ParentExits;
+    Parent->getExitEdges(ParentExits);
+    if (!isBlockDominatingExits(Target->getLoopPreheader(), ParentExits,
+                                LAR.DT) &&
+        !isSafeToSpeculativelyExecute(&Inst))
+      break;
+
+    Target = Parent;
+    if (!BFI || BFI->getBlockFreq(Target->getLoopPreheader()).getFrequency() <=
+                    BFI->getBlockFreq(Coldest->getLoopPreheader()).getFrequency())
+      Coldest = Target;
+  }
+
+  return Coldest;
+}
+
+// Cicli stimati risparmiati per chiamata della funzione: il costo
+// dell'istruzione per la differenza tra le esecuzioni del suo blocco e
+// quelle del preheader, relative all'entry della funzione
+double getEstimatedCyclesSaved(Instruction &Inst, BasicBlock *Target,
+                               const BlockFrequencyInfo &BFI,
+                               const TargetTransformInfo &TTI) {
+  InstructionCost Cost =
+      TTI.getInstructionCost(&Inst, TargetTransformInfo::TCK_Latency);
+  auto Cycles = Cost.getValue();
+  if (!Cycles)
+    return 0;
+
+  uint64_t BlockFreq = BFI.getBlockFreq(Inst.getParent()).getFrequency();
+  uint64_t TargetFreq = BFI.getBlockFreq(Target).getFrequency();
+  return static_cast<double>(*Cycles) * (BlockFreq - TargetFreq) /
+         BFI.getEntryFreq();
+}
+
+// Se V è definito nel loop, per usarlo nel blocco di uscita serve un PHI
+// LCSSA (riusato se esiste già)
+Value *getLCSSAValue(Value *V, BasicBlock *Exit, Loop &L) {
+  auto *Inst = dyn_cast<Instruction>(V);
+  if (!Inst || !L.contains(Inst))
+    return V;
+
+  for (PHINode &Phi : Exit->phis())
+    if (Phi.hasConstantValue() == V)
+      return &Phi;
+
+  PHINode *LCSSAPhi = PHINode::Create(V->getType(), pred_size(Exit),
+                                      V->getName() + ".lcssa", &Exit->front());
+  for (BasicBlock *Pred : predecessors(Exit))
+    LCSSAPhi->addIncoming(V, Pred);
+  return LCSSAPhi;
+}
+
+/**
+  Riscrive gli accessi a un puntatore promosso: le load del loop usano il
+  valore in SSA (PHI nell'header), le store spariscono e viene inserita
+  un'unica store in ogni blocco di uscita. MemorySSA, se presente, viene
+  aggiornata.
+*/
+class LoopPromoter : public LoadAndStorePromoter {
+  Value *Ptr;
+  ArrayRef<BasicBlock *> ExitBlocks;
+  Loop &L;
+  MemorySSAUpdater *MSSAU;
+  Align Alignment;
+
+public:
+  LoopPromoter(Value *Ptr, ArrayRef<const Instruction *> Insts, SSAUpdater &S,
+               ArrayRef<BasicBlock *> ExitBlocks, Loop &L,
+               MemorySSAUpdater *MSSAU, Align Alignment)
+      : LoadAndStorePromoter(Insts, S), Ptr(Ptr), ExitBlocks(ExitBlocks),
+        L(L), MSSAU(MSSAU), Alignment(Alignment) {}
+
+  void doExtraRewritesBeforeFinalDeletion() override {
+    for (BasicBlock *Exit : ExitBlocks) {
+      Value *LiveOut = getLCSSAValue(SSA.GetValueInMiddleOfBlock(Exit), Exit, L);
+      auto *Store = new StoreInst(LiveOut, Ptr, &*Exit->getFirstInsertionPt());
+      Store->setAlignment(Alignment);
+
+      if (MSSAU) {
+        MemoryAccess *Def = MSSAU->createMemoryAccessInBB(
+            Store, nullptr, Exit, MemorySSA::Beginning);
+        MSSAU->insertDef(cast<MemoryDef>(Def), /*RenameUses=*/true);
+      }
+    }
+  }
+
+  void instructionDeleted(Instruction *Inst) const override {
+    if (MSSAU)
+      MSSAU->removeMemoryAccess(Inst);
+  }
+};
+
+// Gli accessi a Ptr possono essere promossi se sono load/store semplici
+// dello stesso tipo, se una store viene eseguita in ogni percorso verso
+// le uscite (la locazione viene comunque scritta) e se nessun'altra
+// istruzione del loop può leggere o scrivere la locazione.
+bool canPromote(Value *Ptr, ArrayRef<Instruction *> Accesses,
+                ArrayRef<Instruction *> MemoryInsts, Loop &L,
+                LoopStandardAnalysisResults &LAR,
+                const SmallVector<std::pair<BasicBlock *, BasicBlock *>>
+                    &ExitBasicBlocks) {
+  Type *AccessTy = getLoadStoreType(Accesses.front());
+  bool HasGuaranteedStore = false;
+
+  for (Instruction *Access : Accesses) {
+    if (getLoadStoreType(Access) != AccessTy)
+      return false;
+
+    if (auto *Load = dyn_cast<LoadInst>(Access)) {
+      if (!Load->isSimple())
+        return false;
+      continue;
+    }
+
+    auto *Store = cast<StoreInst>(Access);
+    if (!Store->isSimple())
+      return false;
+    if (isInstructionDominatedByExits(*Store, ExitBasicBlocks, LAR.DT))
+      HasGuaranteedStore = true;
+  }
+
+  if (!HasGuaranteedStore)
+    return false;
+
+  const DataLayout &DL = L.getHeader()->getModule()->getDataLayout();
+  MemoryLocation Loc(Ptr, LocationSize::precise(DL.getTypeStoreSize(AccessTy)));
+  for (Instruction *Inst : MemoryInsts) {
+    if (is_contained(Accesses, Inst))
+      continue;
+    if (isModOrRefSet(LAR.AA.getModRefInfo(Inst, Loc)))
+      return false;
+  }
+
+  return true;
+}
+
+/**
+  Promozione scalare: le locazioni a indirizzo invariante lette e scritte
+  nel loop vengono tenute in un registro. Il valore viene caricato una volta
+  nel preheader, passa tra le iterazioni con un PHI e viene scritto una
+  volta in ogni blocco di uscita.
+*/
+bool promoteMemoryToRegisters(
+    Loop &L, LoopStandardAnalysisResults &LAR, MemorySSAUpdater *MSSAU,
+    const SmallVector<std::pair<BasicBlock *, BasicBlock *>> &ExitBasicBlocks,
+    OptimizationRemarkEmitter &ORE) {
+  MapVector<Value *, SmallVector<Instruction *, 8>> AccessesByPtr;
+  SmallVector<Instruction *, 32> MemoryInsts;
+
+  for (auto *BB : L.getBlocks()) {
+    for (auto &Inst : *BB) {
+      if (!Inst.mayReadOrWriteMemory())
+        continue;
+
+      // Se un'istruzione può lanciare un'eccezione, gli accessi successivi
+      // non sono garantiti e la store nelle uscite potrebbe non esserci
+      if (Inst.mayThrow())
+        return false;
+
+      MemoryInsts.push_back(&Inst);
+      Value *Ptr = getLoadStorePointerOperand(&Inst);
+      if (Ptr && L.isLoopInvariant(Ptr))
+        AccessesByPtr[Ptr].push_back(&Inst);
+    }
+  }
+
+  SmallVector<BasicBlock *, 8> ExitBlocks;
+  L.getUniqueExitBlocks(ExitBlocks);
+  if (ExitBlocks.empty())
+    return false;
+
+  BasicBlock *Preheader = L.getLoopPreheader();
+  bool Changed = false;
+
+  for (auto &[Ptr, Accesses] : AccessesByPtr) {
+    if (!canPromote(Ptr, Accesses, MemoryInsts, L, LAR, ExitBasicBlocks))
+      continue;
+
+    LLVM_DEBUG(dbgs() << "LICMZ: promoting " << *Ptr << "\n");
+    ++NumPromoted;
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "Promoted", Accesses.front())
+             << "memory accesses to " << ore::NV("Pointer", Ptr)
+             << " promoted to a register";
+    });
+
+    // L'allineamento minimo è valido per tutti gli accessi
+    Align Alignment = getLoadStoreAlignment(Accesses.front());
+    for (Instruction *Access : Accesses)
+      Alignment = std::min(Alignment, getLoadStoreAlignment(Access));
+
+    SmallVector<const Instruction *, 8> ConstAccesses(Accesses.begin(),
+                                                      Accesses.end());
+    SSAUpdater SSA;
+    LoopPromoter Promoter(Ptr, ConstAccesses, SSA, ExitBlocks, L, MSSAU,
+                          Alignment);
+
+    auto *PreheaderLoad =
+        new LoadInst(getLoadStoreType(Accesses.front()), Ptr,
+                     Ptr->getName() + ".promoted", /*isVolatile=*/false,
+                     Alignment, Preheader->getTerminator());
+    if (MSSAU) {
+      MemoryAccess *Use = MSSAU->createMemoryAccessInBB(
+          PreheaderLoad, nullptr, Preheader, MemorySSA::End);
+      MSSAU->insertUse(cast<MemoryUse>(Use), /*RenameUses=*/true);
+    }
+    SSA.AddAvailableValue(Preheader, PreheaderLoad);
+
+    Promoter.run(Accesses);
+    Changed = true;
+  }
+
+  return Changed;
+}
+
+// In forma LCSSA gli usi fuori dal loop sono PHI nei blocchi di uscita.
+// L'istruzione può essere spostata solo se ogni suo uso è un PHI LCSSA che
+// riceve lei da tutti i predecessori: così domina i rami di uscita e i
+// suoi operandi sono disponibili nel blocco di uscita.
+bool getExitPhiUsers(Instruction &Inst, Loop &L,
+                     SmallVectorImpl<PHINode *> &ExitPhis) {
+  for (User *U : Inst.users()) {
+    auto *Phi = dyn_cast<PHINode>(U);
+    if (!Phi || L.contains(Phi) || Phi->hasConstantValue() != &Inst)
+      return false;
+    BasicBlock *Exit = Phi->getParent();
+    if (Exit->getFirstInsertionPt() == Exit->end())
+      return false;
+    ExitPhis.push_back(Phi);
+  }
+
+  return !ExitPhis.empty();
+}
+
+/**
+  Sinking: le istruzioni il cui risultato viene usato solo dopo il loop
+  vengono spostate nei blocchi di uscita, dove sono eseguite una volta sola.
+  L'istruzione viene duplicata solo nelle uscite che la usano (tramite il
+  PHI LCSSA), le uscite che non ne hanno bisogno non la calcolano più. La
+  visita in ordine inverso sui dominatori incontra gli usi prima delle
+  definizioni, quindi intere catene vengono spostate in un passaggio.
+*/
+bool sinkToExitBlocks(Loop &L, LoopStandardAnalysisResults &LAR,
+                      MemorySSAUpdater *MSSAU,
+                      OptimizationRemarkEmitter &ORE) {
+  bool Changed = false;
+
+  for (DomTreeNode *Node :
+       reverse(collectChildrenInLoop(LAR.DT.getNode(L.getHeader()), &L))) {
+    for (Instruction &Inst : make_early_inc_range(reverse(*Node->getBlock()))) {
+      if (isa<PHINode>(Inst) || !canHoistInstruction(Inst, L, LAR.MSSA, LAR.AA))
+        continue;
+
+      SmallVector<PHINode *, 4> ExitPhis;
+      if (!getExitPhiUsers(Inst, L, ExitPhis))
+        continue;
+
+      // Una copia per ogni blocco di uscita che usa il valore
+      SmallDenseMap<BasicBlock *, Instruction *, 4> Clones;
+      for (PHINode *Phi : ExitPhis) {
+        BasicBlock *Exit = Phi->getParent();
+        Instruction *&Clone = Clones[Exit];
+        if (!Clone) {
+          Clone = Inst.clone();
+          Clone->setName(Inst.getName() + ".sunk");
+          Clone->insertBefore(&*Exit->getFirstInsertionPt());
+          for (Use &Usee : Clone->operands())
+            Usee.set(getLCSSAValue(Usee.get(), Exit, L));
+
+          if (MSSAU && LAR.MSSA->getMemoryAccess(&Inst)) {
+            MemoryAccess *Use = MSSAU->createMemoryAccessInBB(
+                Clone, nullptr, Exit, MemorySSA::Beginning);
+            MSSAU->insertUse(cast<MemoryUse>(Use), /*RenameUses=*/true);
+          }
+        }
+
+        LAR.SE.forgetValue(Phi);
+        Phi->replaceAllUsesWith(Clone);
+        Phi->eraseFromParent();
+      }
+
+      LLVM_DEBUG(dbgs() << "LICMZ: sinking " << Inst << " to "
+                        << Clones.size() << " exit blocks\n");
+      ++NumSunk;
+      ORE.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, "Sunk", &Inst)
+               << "sinking " << ore::NV("Inst", &Inst) << " to "
+               << ore::NV("NumExits", static_cast<unsigned>(Clones.size()))
+               << " exit blocks";
+      });
+
+      LAR.SE.forgetValue(&Inst);
+      if (MSSAU)
+        MSSAU->removeMemoryAccess(&Inst);
+      Inst.eraseFromParent();
+      Changed = true;
+    }
+  }
+
+  return Changed;
+}
+
+// Conviene duplicare il loop se almeno una load a indirizzo invariante è
+// bloccata solo da scritture che potrebbero essere alias, ma non lo sono
+// sicuramente: con il controllo a runtime la copia veloce può spostarla.
+bool hasLoadBlockedByMayAlias(Loop &L, LoopStandardAnalysisResults &LAR) {
+  SmallVector<Instruction *, 16> Writes;
+  SmallVector<LoadInst *, 16> Loads;
+  for (auto *BB : L.getBlocks()) {
+    for (auto &Inst : *BB) {
+      if (Inst.mayWriteToMemory())
+        Writes.push_back(&Inst);
+      if (auto *Load = dyn_cast<LoadInst>(&Inst); Load && Load->isSimple())
+        Loads.push_back(Load);
+    }
+  }
+
+  for (LoadInst *Load : Loads) {
+    const SCEV *Ptr = LAR.SE.getSCEV(Load->getPointerOperand());
+    if (!LAR.SE.isLoopInvariant(Ptr, &L))
+      continue;
+
+    MemoryLocation Loc = MemoryLocation::get(Load);
+    bool Blocked = false;
+    bool MustAlias = false;
+    for (Instruction *Write : Writes) {
+      if (!isModSet(LAR.AA.getModRefInfo(Write, Loc)))
+        continue;
+      Blocked = true;
+      if (auto *Store = dyn_cast<StoreInst>(Write))
+        MustAlias |= LAR.AA.isMustAlias(MemoryLocation::get(Store), Loc);
+    }
+
+    if (Blocked && !MustAlias)
+      return true;
+  }
+
+  return false;
+}
+
+/**
+  Loop versioning: il loop viene duplicato e la copia originale resta come
+  fallback. La versione usata quando i controlli a runtime (costruiti da
+  LoopAccessAnalysis sugli intervalli SCEV degli accessi) garantiscono che
+  i puntatori non si sovrappongono viene annotata con metadati noalias,
+  così l'alias analysis permette di spostare le load invarianti.
+*/
+bool versionLoopForAliasing(Loop &L, LoopStandardAnalysisResults &LAR,
+                            LPMUpdater &LU, OptimizationRemarkEmitter &ORE) {
+  if (!L.isInnermost() || findStringMetadataForLoop(&L, VersioningDisabled) ||
+      !hasLoadBlockedByMayAlias(L, LAR))
+    return false;
+
+  LoopAccessInfo LAI(&L, &LAR.SE, &LAR.TTI, &LAR.TLI, &LAR.AA, &LAR.DT,
+                     &LAR.LI);
+  const RuntimePointerChecking *Checking = LAI.getRuntimePointerChecking();
+  if (!LAI.canVectorizeMemory() || !Checking->Need ||
+      Checking->getChecks().empty()) {
+    ORE.emit([&]() {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "NotVersioned",
+                                      L.getStartLoc(), L.getHeader())
+             << "loop not versioned: runtime alias checks not available";
+    });
+    return false;
+  }
+
+  unsigned NumChecks = LAI.getNumRuntimePointerChecks();
+  if (NumChecks > VersioningMaxChecks) {
+    ORE.emit([&]() {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "NotVersioned",
+                                      L.getStartLoc(), L.getHeader())
+             << "loop not versioned: " << ore::NV("NumChecks", NumChecks)
+             << " runtime alias checks needed";
+    });
+    return false;
+  }
+
+  LoopVersioning LVer(LAI, Checking->getChecks(), &L, &LAR.LI, &LAR.DT,
+                      &LAR.SE);
+  LVer.versionLoop();
+  LVer.annotateLoopWithNoAlias();
+
+  Loop *Fallback = LVer.getNonVersionedLoop();
+  addStringMetadataToLoop(&L, VersioningDisabled);
+  addStringMetadataToLoop(Fallback, VersioningDisabled);
+  LU.addSiblingLoops({Fallback});
+
+  LLVM_DEBUG(dbgs() << "LICMZ: versioned " << L.getName() << " with "
+                    << NumChecks << " runtime checks\n");
+  ++NumVersioned;
+  ORE.emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "Versioned", L.getStartLoc(),
+                              L.getHeader())
+           << "loop versioned with " << ore::NV("NumChecks", NumChecks)
+           << " runtime alias checks";
+  });
+  return true;
+}
+
 PreservedAnalyses LICMZ::run(Loop &L, LoopAnalysisManager &LAM,
                              LoopStandardAnalysisResults &LAR, LPMUpdater &LU) {
 
-  outs() << "LICMZ pass is running!\n";
+  LLVM_DEBUG(dbgs() << "LICMZ: running on " << L.getName() << "\n");
+
+  // Come LICM, l'emitter viene creato localmente perché non fa parte dei
+  // risultati standard dei loop pass
+  OptimizationRemarkEmitter ORE(L.getHeader()->getParent());
 
   if (!L.isLoopSimplifyForm()) {
-    outs() << "The loop is not in normal form\n";
+    ORE.emit([&]() {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "NotSimplifyForm",
+                                      L.getStartLoc(), L.getHeader())
+             << "loop is not in simplify form";
+    });
     return PreservedAnalyses::all();
   }
 
-  auto LBlocks = L.getBlocks();
-  auto *LPreHeader = L.getLoopPreheader();
-  Instruction &LastInstruction = LPreHeader->back();
   bool hasChanged = false;
 
+  // Il versioning crea nuovi blocchi che MemorySSA non conosce: è
+  // disponibile solo fuori da loop-mssa
+  if (Versioning) {
+    if (LAR.MSSA) {
+      ORE.emit([&]() {
+        return OptimizationRemarkMissed(DEBUG_TYPE, "NotVersioned",
+                                        L.getStartLoc(), L.getHeader())
+               << "loop not versioned: not available under loop-mssa";
+      });
+    } else {
+      hasChanged |= versionLoopForAliasing(L, LAR, LU, ORE);
+    }
+  }
+
+  std::optional<MemorySSAUpdater> MSSAU;
+  if (LAR.MSSA)
+    MSSAU.emplace(LAR.MSSA);
+
+  // Le frequenze dei blocchi vengono solo lette, mai calcolate qui: sarebbe
+  // una visita dell'intera funzione per ogni loop. Come per LICM, sono nei
+  // risultati standard solo se l'adaptor è creato con
+  // UseBlockFrequencyInfo=true e la funzione ha dati di profilo;
+  // altrimenti si sposta senza euristica.
+  // Spostare istruzioni non cambia il CFG, il versioning sì: dopo un
+  // versioning, o se un loop già visitato può essere stato versionato, le
+  // frequenze non sono più valide. Se ci sono dati PGO,
+  // BranchProbabilityInfo usa i pesi dei branch del profilo.
+  const BlockFrequencyInfo *BFI = nullptr;
+  if (UseBlockFrequency && !hasChanged && (!Versioning || LAR.MSSA))
+    BFI = LAR.BFI;
+  double CyclesSaved = 0;
+
   // Taken from LoopPeel.cpp (Loop peeling utilies)
   // - first: Il blocco all'interno del loop da cui parte l'arco di uscita.
   // - second: Il blocco fuori dal loop verso cui punta l'arco.
   llvm::SmallVector<std::pair<BasicBlock *, BasicBlock *>> ExitBasicBlocks;
   L.getExitEdges(ExitBasicBlocks);
 
-  // Itero sui blocchi del loop
-  for (auto *BB : LBlocks) {
+  // Istruzioni rimaste nel loop di cui è già stata dimostrata l'invarianza
+  SmallPtrSet<Instruction *, 32> Invariants;
+
+  // Loop più esterno in cui è stata spostata almeno un'istruzione
+  Loop *Outermost = nullptr;
+
+  // Itero sui blocchi del loop in preordine sull'albero dei dominatori:
+  // ogni definizione viene visitata prima dei suoi usi, quindi intere
+  // catene di istruzioni invarianti vengono spostate in un solo passaggio
+  for (DomTreeNode *Node :
+       collectChildrenInLoop(LAR.DT.getNode(L.getHeader()), &L)) {
+    BasicBlock *BB = Node->getBlock();
+    // La dominanza delle uscite dipende solo dal blocco
+    bool DominatesExits =
+        isBlockDominatingExits(BB, ExitBasicBlocks, LAR.DT);
+
     // Trovo le loop-invariant instructions
     for (auto iter = BB->begin(); iter != BB->end();) {
-      outs() << "--------------------------------\n";
-      outs() << "Checking instruction\n";
       Instruction &Inst = *iter++;
 
-      if (!isInstructionInvariant(Inst, L)) {
-        outs() << "Instruction is not invariant\n";
-        Inst.print(outs());
-        outs() << "\n";
+      if (!isInstructionInvariant(Inst, L, Invariants)) {
+        ++NumNotInvariant;
+        continue;
+      }
+
+      if (!canHoistInstruction(Inst, L, LAR.MSSA, LAR.AA)) {
+        ++NumNotHoistable;
+        if (isa<LoadInst>(Inst)) {
+          ORE.emit([&]() {
+            return OptimizationRemarkMissed(DEBUG_TYPE, "LoadNotHoisted",
+                                            &Inst)
+                   << "load not hoisted: memory may be written in the loop";
+          });
+        }
+        continue;
+      }
+
+      Invariants.insert(&Inst);
 
+      // Un operando invariante che non è stato spostato impedisce di
+      // spostare anche l'istruzione
+      if (any_of(Inst.operands(), [&](const Use &Usee) {
+            auto *OpInst = dyn_cast<Instruction>(Usee);
+            return OpInst && L.contains(OpInst);
+          })) {
+        ++NumOperandNotHoisted;
+        ORE.emit([&]() {
+          return OptimizationRemarkMissed(DEBUG_TYPE, "OperandNotHoisted",
+                                          &Inst)
+                 << "invariant instruction not hoisted: an operand stays in "
+                    "the loop";
+        });
         continue;
       }
 
       // Verifica dominanza e dead code
-      if (!isInstructionDominatedByExits(Inst, ExitBasicBlocks, LAR.DT) &&
-          !isDeadCode(Inst, L)) {
-        outs() << "Instruction not dominates all the loop exit or is not "
-                  "dead code after the loop\n";
-        Inst.print(outs());
-        outs() << "\n";
+      if (!DominatesExits && !isDeadCode(Inst, L)) {
+        ++NumNotDominatingExits;
+        ORE.emit([&]() {
+          return OptimizationRemarkMissed(DEBUG_TYPE, "NotDominatingExits",
+                                          &Inst)
+                 << "invariant instruction not hoisted: not dominating exits "
+                    "and used after the loop";
+        });
         continue;
       }
 
-      outs() << "Instruction is loop invariant\n";
-      Inst.print(outs());
-      outs() << "\n";
+      // Se non domina le uscite, nel preheader verrebbe eseguita anche nei
+      // percorsi che la saltano: non deve poter causare trap
+      if (!DominatesExits && !isSafeToSpeculativelyExecute(&Inst)) {
+        ++NumNotSafeToSpeculate;
+        ORE.emit([&]() {
+          return OptimizationRemarkMissed(DEBUG_TYPE, "NotSafeToSpeculate",
+                                          &Inst)
+                 << "invariant instruction not hoisted: not safe to execute "
+                    "speculatively";
+        });
+        continue;
+      }
+
+      // Se è invariante anche nei loop esterni sale direttamente al
+      // preheader del più esterno, senza aspettare che il pass manager
+      // visiti ogni livello
+      Loop *Target = getOutermostHoistLoop(Inst, L, LAR, BFI);
+      BasicBlock *TargetPreHeader = Target->getLoopPreheader();
+
+      // Un blocco eseguito meno spesso del preheader (ad esempio un ramo di
+      // errore) renderebbe l'istruzione più costosa una volta spostata
+      if (BFI && BFI->getBlockFreq(BB).getFrequency() <=
+                     BFI->getBlockFreq(TargetPreHeader).getFrequency()) {
+        ++NumNotProfitable;
+        ORE.emit([&]() {
+          return OptimizationRemarkMissed(DEBUG_TYPE, "NotProfitable", &Inst)
+                 << "invariant instruction not hoisted: its block runs less "
+                    "often than the preheader";
+        });
+        continue;
+      }
+      if (BFI)
+        CyclesSaved +=
+            getEstimatedCyclesSaved(Inst, TargetPreHeader, *BFI, LAR.TTI);
+      unsigned NumLoops = L.getLoopDepth() - Target->getLoopDepth() + 1;
+      if (!Outermost || Target->getLoopDepth() < Outermost->getLoopDepth())
+        Outermost = Target;
+
+      LLVM_DEBUG(dbgs() << "LICMZ: hoisting " << Inst << " out of "
+                        << NumLoops << " loops\n");
+      ++NumHoisted;
+      if (isa<LoadInst>(Inst))
+        ++NumLoadsHoisted;
+      if (NumLoops > 1)
+        ++NumHoistedOutOfNest;
+      ORE.emit([&]() {
+        OptimizationRemark R(DEBUG_TYPE, "Hoisted", &Inst);
+        R << "hoisting " << ore::NV("Inst", &Inst) << " to preheader";
+        if (NumLoops > 1)
+          R << " out of " << ore::NV("NumLoops", NumLoops) << " loops";
+        return R;
+      });
 
       // Sposta l'istruzione nel preheader del loop
-      outs() << "Moving instruction to loop preheader\n";
-      outs() << "Last instruction in preheader: ";
-      LPreHeader->back().print(outs());
-      outs() << "\n";
+      Invariants.erase(&Inst);
       Inst.removeFromParent();
-      Inst.insertBefore(&LPreHeader->back());
+      Inst.insertBefore(&TargetPreHeader->back());
+      if (MSSAU) {
+        if (auto *Access = LAR.MSSA->getMemoryAccess(&Inst))
+          MSSAU->moveToPlace(Access, TargetPreHeader,
+                             MemorySSA::BeforeTerminator);
+      }
 
       hasChanged = true;
     }
   }
 
-  return hasChanged ? PreservedAnalyses::none() : PreservedAnalyses::all();
+  if (CyclesSaved > 0) {
+    ORE.emit([&]() {
+      return OptimizationRemarkAnalysis(DEBUG_TYPE, "CyclesSaved",
+                                        L.getStartLoc(), L.getHeader())
+             << "hoisting saves an estimated "
+             << ore::NV("Cycles", static_cast<uint64_t>(CyclesSaved + 0.5))
+             << " cycles per call";
+    });
+  }
+
+  // Quello che non è stato spostato nel preheader ed è usato solo dopo il
+  // loop viene spostato nelle uscite
+  hasChanged |= sinkToExitBlocks(L, LAR, MSSAU ? &*MSSAU : nullptr, ORE);
+
+  hasChanged |= promoteMemoryToRegisters(L, LAR, MSSAU ? &*MSSAU : nullptr,
+                                         ExitBasicBlocks, ORE);
+
+  if (!hasChanged)
+    return PreservedAnalyses::all();
+
+  // Le istruzioni spostate cambiano la relazione con il loop dei SCEV
+  LAR.SE.forgetLoopDispositions();
+
+  auto PA = getLoopPassPreservedAnalyses();
+
+  // Il pass manager invalida solo i risultati di L: i loop esterni
+  // attraversati dalle istruzioni spostate hanno perso del codice, quindi
+  // anche le loro analisi vanno invalidate. La struttura dei loop non
+  // cambia, LU non va aggiornato.
+  if (Outermost)
+    for (Loop *Outer = L.getParentLoop(); Outer != Outermost->getParentLoop();
+         Outer = Outer->getParentLoop())
+      LAM.invalidate(*Outer, PA);
+  if (LAR.MSSA)
+    PA.preserve<MemorySSAAnalysis>();
+  return PA;
 }
\ No newline at end of file
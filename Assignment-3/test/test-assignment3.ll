@@ -40,3 +40,230 @@ entry:
   call void @foo(i32 5, i32 3)
   ret i32 0
 }
+
+; Accumulator over a heap array (*acc += arr[i] for i < *len):
+; the load of *len is hoisted because nothing in the loop can write it,
+; *acc is promoted to a phi with a single store in the exit block
+define void @accumulate(i32* noalias %acc, i32* noalias %len, i32* %arr) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %loop ]
+  %n = load i32, i32* %len, align 4
+  %idx = sext i32 %i to i64
+  %ptr = getelementptr inbounds i32, i32* %arr, i64 %idx
+  %elem = load i32, i32* %ptr, align 4
+  %old = load i32, i32* %acc, align 4
+  %new = add i32 %old, %elem
+  store i32 %new, i32* %acc, align 4
+  %i_next = add i32 %i, 1
+  %cmp = icmp slt i32 %i_next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; Load from a pointer that may alias the store in the loop: not hoisted
+define void @may_alias(i32* %p, i32* %q) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %loop ]
+  %v = load i32, i32* %p, align 4
+  %w = add i32 %v, %i
+  store i32 %w, i32* %q, align 4
+  %i_next = add i32 %i, 1
+  %cmp = icmp slt i32 %i_next, 10
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; Invariant chain spread over the loop blocks: x * 2 and its users are
+; hoisted in one pass; the division on the guarded path could trap and
+; stays in the loop, so the add that uses it stays too
+define i32 @invariant_chain(i32 %x, i32 %y, i32 %n) {
+entry:
+  br label %header
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %latch ]
+  %acc = phi i32 [ 0, %entry ], [ %acc_next, %latch ]
+  %t0 = mul i32 %x, 2
+  %odd = and i32 %i, 1
+  %is_odd = icmp eq i32 %odd, 1
+  br i1 %is_odd, label %guarded, label %latch
+
+guarded:
+  %q = sdiv i32 %t0, %y
+  %q1 = add i32 %q, 1
+  br label %latch
+
+latch:
+  %v = phi i32 [ %q1, %guarded ], [ 0, %header ]
+  %t1 = add i32 %t0, 7
+  %t2 = shl i32 %t1, 1
+  %sum = add i32 %acc, %v
+  %acc_next = add i32 %sum, %t2
+  %i_next = add i32 %i, 1
+  %cmp = icmp slt i32 %i_next, %n
+  br i1 %cmp, label %header, label %exit
+
+exit:
+  ret i32 %acc_next
+}
+
+; *b is invariant only when b does not point into a: with
+; -licmz-versioning the loop is duplicated behind a runtime overlap check
+; and the load is hoisted out of the no-alias copy
+define void @version_kernel(i32* %a, i32* %b, i32 %n) {
+entry:
+  %guard = icmp sgt i32 %n, 0
+  br i1 %guard, label %preheader, label %end
+
+preheader:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %preheader ], [ %i_next, %loop ]
+  %v = load i32, i32* %b, align 4
+  %s = add i32 %v, %i
+  %idx = zext i32 %i to i64
+  %p = getelementptr inbounds i32, i32* %a, i64 %idx
+  store i32 %s, i32* %p, align 4
+  %i_next = add nuw nsw i32 %i, 1
+  %cmp = icmp slt i32 %i_next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  br label %end
+
+end:
+  ret void
+}
+
+; %d is only needed on the %found exit and %sq only on the %miss exit:
+; both chains are sunk into the exit that uses them
+define i32 @sink_exits(i32* %a, i32 %n, i32 %k) {
+entry:
+  br label %header
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %latch ]
+  %idx = zext i32 %i to i64
+  %p = getelementptr inbounds i32, i32* %a, i64 %idx
+  %v = load i32, i32* %p, align 4
+  %m = mul i32 %v, %k
+  %m2 = add i32 %m, %i
+  %d = sdiv i32 %m2, %k
+  %is_found = icmp eq i32 %v, 42
+  br i1 %is_found, label %found, label %latch
+
+latch:
+  %sq = mul i32 %i, %i
+  %i_next = add i32 %i, 1
+  %cmp = icmp slt i32 %i_next, %n
+  br i1 %cmp, label %header, label %miss
+
+found:
+  %d.lcssa = phi i32 [ %d, %header ]
+  ret i32 %d.lcssa
+
+miss:
+  %sq.lcssa = phi i32 [ %sq, %latch ]
+  %r = sub i32 0, %sq.lcssa
+  ret i32 %r
+}
+
+; Stencil-like 3-deep nest: x * y is invariant in the whole nest and is
+; hoisted to the entry, x * y + i goes to the preheader of the j loop and
+; only the parts that depend on j or k stay in the inner loops
+define i32 @nest_address(i32* %a, i32 %x, i32 %y, i32 %n) {
+entry:
+  br label %outer
+
+outer:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %outer.latch ]
+  %acc1 = phi i32 [ 0, %entry ], [ %acc2.lcssa, %outer.latch ]
+  br label %middle.ph
+
+middle.ph:
+  br label %middle
+
+middle:
+  %j = phi i32 [ 0, %middle.ph ], [ %j_next, %middle.latch ]
+  %acc2 = phi i32 [ %acc1, %middle.ph ], [ %acc3.lcssa, %middle.latch ]
+  br label %inner.ph
+
+inner.ph:
+  br label %inner
+
+inner:
+  %k = phi i32 [ 0, %inner.ph ], [ %k_next, %inner ]
+  %acc3 = phi i32 [ %acc2, %inner.ph ], [ %acc_next, %inner ]
+  %base = mul i32 %x, %y
+  %row = add i32 %base, %i
+  %col = add i32 %row, %j
+  %off = add i32 %col, %k
+  %idx = zext i32 %off to i64
+  %p = getelementptr inbounds i32, i32* %a, i64 %idx
+  %v = load i32, i32* %p, align 4
+  %acc_next = add i32 %acc3, %v
+  %k_next = add i32 %k, 1
+  %cmp_k = icmp slt i32 %k_next, %n
+  br i1 %cmp_k, label %inner, label %middle.latch
+
+middle.latch:
+  %acc3.lcssa = phi i32 [ %acc_next, %inner ]
+  %j_next = add i32 %j, 1
+  %cmp_j = icmp slt i32 %j_next, %n
+  br i1 %cmp_j, label %middle, label %outer.latch
+
+outer.latch:
+  %acc2.lcssa = phi i32 [ %acc3.lcssa, %middle.latch ]
+  %i_next = add i32 %i, 1
+  %cmp_i = icmp slt i32 %i_next, %n
+  br i1 %cmp_i, label %outer, label %exit
+
+exit:
+  %acc1.lcssa = phi i32 [ %acc2.lcssa, %outer.latch ]
+  ret i32 %acc1.lcssa
+}
+
+; The error path is taken once every 100000 iterations according to the
+; branch weights: x / 7 is invariant and safe to speculate, but in the
+; preheader it would run on every call, so only x * 3 is hoisted. The
+; frequencies are there only with an adaptor created with
+; UseBlockFrequencyInfo=true: loop-mssa(licmz) hoists both
+define i32 @cold_path(i32 %x, i32 %n) !prof !1 {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %latch ]
+  %acc = phi i32 [ 0, %entry ], [ %acc_next, %latch ]
+  %hot = mul i32 %x, 3
+  %is_err = icmp eq i32 %i, 1000
+  br i1 %is_err, label %error, label %latch, !prof !0
+
+error:
+  %q = udiv i32 %x, 7
+  br label %latch
+
+latch:
+  %v = phi i32 [ %q, %error ], [ %hot, %loop ]
+  %acc_next = add i32 %acc, %v
+  %i_next = add i32 %i, 1
+  %cmp = icmp slt i32 %i_next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret i32 %acc_next
+}
+
+!0 = !{!"branch_weights", i32 1, i32 100000}
+!1 = !{!"function_entry_count", i64 1000}
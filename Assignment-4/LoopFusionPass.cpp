@@ -9,10 +9,97 @@
 //===------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Utils/LoopFusionPass.h"
+#include "LoopFusionUtils.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include <map>
 
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "loopfusionpass"
+
+STATISTIC(NumFused, "Number of loops fused");
+STATISTIC(NumNestsFused, "Number of loop nests fused at the outer level");
+STATISTIC(NumNotMergeable, "Number of loops without the required structure");
+STATISTIC(NumNotAdjacent, "Number of candidate pairs not adjacent");
+STATISTIC(NumTripCountDiffer, "Number of candidate pairs with different "
+                              "trip counts");
+STATISTIC(NumNotControlFlowEquivalent,
+          "Number of candidate pairs not control flow equivalent");
+STATISTIC(NumNegativeDistance,
+          "Number of candidate pairs with negative distance dependencies");
+STATISTIC(NumCodeMoved, "Number of instructions moved from between two loops "
+                        "to make them adjacent");
+STATISTIC(NumHeaderPhis, "Number of candidate pairs whose second header "
+                         "defines values other than affine induction "
+                         "variables");
+STATISTIC(NumPeeled, "Number of loops peeled to match trip counts");
+STATISTIC(NumUnprofitable,
+          "Number of candidate pairs not fused by the cost model");
+STATISTIC(NumLoadsForwarded,
+          "Number of loads replaced by a value stored or loaded earlier in "
+          "the same iteration of a fused loop");
+STATISTIC(NumArraysRemoved,
+          "Number of temporary arrays removed after store forwarding");
+STATISTIC(NumUnrolledAndJammed, "Number of loop nests unrolled and jammed");
+STATISTIC(NumNotUnrolledAndJammed,
+          "Number of two-level loop nests not unrolled and jammed");
+
+static cl::opt<unsigned> MaxPeelCount(
+    "loopfusionpass-max-peel", cl::init(2), cl::Hidden,
+    cl::desc("Maximum number of iterations peeled off the longer of two "
+             "loops whose trip counts differ by a constant"));
+
+static cl::opt<bool> CostModel(
+    "loopfusionpass-cost-model", cl::init(true), cl::Hidden,
+    cl::desc("Fuse a legal pair only when the estimated gain from data "
+             "reuse outweighs register spills and lost vectorization"));
+
+static cl::opt<unsigned> UnrollAndJamFactor(
+    "loopfusionpass-unroll-and-jam", cl::init(1), cl::Hidden,
+    cl::desc("Unroll the outer loop of two-level nests by this factor and "
+             "fuse the copies of the inner loop (1 disables unroll-and-jam)"));
+
+// Cicli risparmiati per ogni accesso di L2 che trova in cache i dati letti
+// o scritti da L1, e costo di un registro in più (uno store e un load)
+constexpr int ReuseGain = 4;
+constexpr int SpillCost = 2;
+
+// Remark "missed" per una coppia di loop candidata, con il motivo
+void reportNotFused(OptimizationRemarkEmitter &ORE, Loop *L1, Loop *L2,
+                    StringRef RemarkName, StringRef Reason) {
+  LLVM_DEBUG(dbgs() << "LoopFusionPass: " << L1->getName() << " and "
+                    << L2->getName() << " not fused: " << Reason << "\n");
+  ORE.emit([&]() {
+    return OptimizationRemarkMissed(DEBUG_TYPE, RemarkName, L1->getStartLoc(),
+                                    L1->getHeader())
+           << "loop not fused with " << ore::NV("Loop", L2->getName()) << ": "
+           << Reason;
+  });
+}
+
 BasicBlock *getLoopBody(Loop *L, LoopInfo &LI) {
   BasicBlock *Header = L->getHeader();
   if (!Header) {
@@ -47,6 +134,13 @@ BasicBlock *getLoopEntry(Loop *L) {
   return Preheader->getUniquePredecessor();
 }
 
+// Blocco che contiene solo un salto incondizionato e ha un solo
+// predecessore: dopo la fusione non è più raggiungibile e viene cancellato
+bool isEmptyForwardingBlock(BasicBlock *BB) {
+  return &BB->front() == BB->getTerminator() && BB->getSingleSuccessor() &&
+         BB->getSinglePredecessor();
+}
+
 bool areLoopAdjacent(Loop *L1, Loop *L2) {
   if (!L1 || !L2) {
     return false;
@@ -76,6 +170,12 @@ bool areLoopAdjacent(Loop *L1, Loop *L2) {
     return false;
   }
 
+  // Il preheader di L2 viene eliminato con la fusione: non deve contenere
+  // altro che il salto all'header
+  if (!EntryL2 || !isEmptyForwardingBlock(EntryL2)) {
+    return false;
+  }
+
   // Verifico se il suo blocco di uscita punta al blocco di ingresso di L2
   SmallVector<BasicBlock *, 4> ExitingBlocks;
   L1->getExitingBlocks(ExitingBlocks);
@@ -86,9 +186,17 @@ bool areLoopAdjacent(Loop *L1, Loop *L2) {
       continue;
     }
 
-    // Controlla se uno dei successori è il blocco di ingresso di L2
+    // Controlla se uno dei successori è il blocco di ingresso di L2,
+    // saltando i blocchi vuoti in mezzo (ad esempio l'uscita di un loop
+    // interno seguita dal preheader del successivo)
     for (unsigned i = 0; i < Term->getNumSuccessors(); ++i) {
-      if (Term->getSuccessor(i) == EntryL2) {
+      BasicBlock *Succ = Term->getSuccessor(i);
+      while (Succ != EntryL2 && !L1->contains(Succ) &&
+             isEmptyForwardingBlock(Succ)) {
+        Succ = Succ->getSingleSuccessor();
+      }
+
+      if (Succ == EntryL2) {
         return true;
       }
     }
@@ -115,104 +223,1185 @@ bool areLoopsControlFlowEquivalent(Loop *L1, Loop *L2, DominatorTree &DT,
 }
 
 bool areLoopTripCountEquivalent(Loop *L1, Loop *L2, ScalarEvolution &SE) {
+  if (!L1->getExitingBlock() || !L2->getExitingBlock()) {
+    return false;
+  }
+
   const SCEV *TripCount1 =
       SE.getTripCountFromExitCount(SE.getExitCount(L1, L1->getExitingBlock()));
   const SCEV *TripCount2 =
       SE.getTripCountFromExitCount(SE.getExitCount(L2, L2->getExitingBlock()));
 
-  return TripCount1 == TripCount2;
+  // Due trip count sconosciuti non sono necessariamente uguali
+  if (isa<SCEVCouldNotCompute>(TripCount1) ||
+      isa<SCEVCouldNotCompute>(TripCount2)) {
+    return false;
+  }
+
+  // Con induzioni di tipo diverso si confrontano nel tipo più largo
+  Type *Ty = SE.getWiderType(TripCount1->getType(), TripCount2->getType());
+  return SE.getNoopOrZeroExtend(TripCount1, Ty) ==
+         SE.getNoopOrZeroExtend(TripCount2, Ty);
+}
+
+// Due nidi di loop hanno la stessa struttura se a ogni livello i loop
+// corrispondenti iterano lo stesso numero di volte: dopo la fusione dei
+// loop esterni, anche quelli interni diventano adiacenti e fondibili
+bool areLoopNestsEquivalent(Loop *L1, Loop *L2, ScalarEvolution &SE) {
+  if (!areLoopTripCountEquivalent(L1, L2, SE)) {
+    return false;
+  }
+
+  if (L1->getSubLoops().size() != L2->getSubLoops().size()) {
+    return false;
+  }
+
+  for (auto [SubL1, SubL2] : zip(L1->getSubLoops(), L2->getSubLoops())) {
+    if (!areLoopNestsEquivalent(SubL1, SubL2, SE)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Accessi e risultati del controllo delle dipendenze, validi finché i loop
+// non vengono modificati da una fusione. Le mappe sono ordinate per
+// indirizzo, i riferimenti agli elementi restano validi.
+struct DependenceCache {
+  map<Loop *, LoopMemoryAccesses> Accesses;
+  map<pair<Loop *, Loop *>, bool> NegativeDistance;
+
+  // Scarta i risultati delle coppie che contengono L
+  void forgetPairs(Loop *L) {
+    for (auto It = NegativeDistance.begin(); It != NegativeDistance.end();) {
+      if (It->first.first == L || It->first.second == L) {
+        It = NegativeDistance.erase(It);
+      } else {
+        ++It;
+      }
+    }
+  }
+
+  // Da chiamare prima di fondere L2 in L1. Cambiano L1, i loop che lo
+  // contengono e i loop interni di entrambi, che ora usano l'induzione di
+  // L1. Gli accessi di L2 passano a L1, tranne quelli dell'header e del
+  // latch che vengono cancellati: L1 non viene riletto a ogni fusione.
+  // I loop esterni perdono gli stessi accessi e vengono riletti.
+  void fuse(Loop *L1, Loop *L2) {
+    for (Loop *Outer = L1->getParentLoop(); Outer;
+         Outer = Outer->getParentLoop()) {
+      forgetPairs(Outer);
+      Accesses.erase(Outer);
+    }
+    for (Loop *L : {L1, L2}) {
+      for (Loop *Inner : L->getLoopsInPreorder()) {
+        forgetPairs(Inner);
+      }
+    }
+
+    auto ItL1 = Accesses.find(L1);
+    auto ItL2 = Accesses.find(L2);
+    if (ItL1 != Accesses.end() && ItL2 != Accesses.end()) {
+      BasicBlock *HeaderL2 = L2->getHeader();
+      BasicBlock *LatchL2 = L2->getLoopLatch();
+      auto isRemoved = [&](Instruction *I) {
+        return I->getParent() == HeaderL2 || I->getParent() == LatchL2;
+      };
+
+      for (const auto &[Object, Insts] : ItL2->second.ByObject) {
+        for (Instruction *I : Insts) {
+          if (!isRemoved(I)) {
+            ItL1->second.add(Object, I);
+          }
+        }
+      }
+      for (Instruction *I : ItL2->second.Unknown) {
+        if (!isRemoved(I)) {
+          ItL1->second.Unknown.push_back(I);
+        }
+      }
+    } else {
+      Accesses.erase(L1);
+    }
+    Accesses.erase(L2);
+  }
+};
+
+void collectMemoryAccesses(Loop *L, LoopMemoryAccesses &Accesses) {
+  for (BasicBlock *BB : L->blocks()) {
+    for (Instruction &I : *BB) {
+      if (!I.mayReadOrWriteMemory()) {
+        continue;
+      }
+
+      // Come DI, solo load e store non atomici e non volatili
+      Value *Ptr = nullptr;
+      if (auto *Load = dyn_cast<LoadInst>(&I); Load && Load->isUnordered()) {
+        Ptr = Load->getPointerOperand();
+      } else if (auto *Store = dyn_cast<StoreInst>(&I);
+                 Store && Store->isUnordered()) {
+        Ptr = Store->getPointerOperand();
+      }
+
+      if (!Ptr) {
+        Accesses.Unknown.push_back(&I);
+        continue;
+      }
+
+      Accesses.add(getUnderlyingObject(Ptr), &I);
+    }
+  }
+}
+
+const LoopMemoryAccesses &getMemoryAccesses(Loop *L, DependenceCache &Cache) {
+  auto [It, Inserted] = Cache.Accesses.try_emplace(L);
+  if (Inserted) {
+    collectMemoryAccesses(L, It->second);
+  }
+  return It->second;
+}
+
+// Riscrive le AddRec di un loop come AddRec del loop che gli corrisponde:
+// gli indirizzi di due loop si confrontano come se fossero già fusi.
+// L'estensione di una ricorrenza affine diventa la ricorrenza delle
+// estensioni solo se la ricorrenza non va in overflow: altrimenti un indice
+// stretto ritorna sugli stessi elementi e la distanza calcolata sarebbe
+// sbagliata.
+class AddRecLoopReplacer : public SCEVRewriteVisitor<AddRecLoopReplacer> {
+  const DenseMap<const Loop *, const Loop *> &LoopMap;
+
+public:
+  AddRecLoopReplacer(ScalarEvolution &SE,
+                     const DenseMap<const Loop *, const Loop *> &LoopMap)
+      : SCEVRewriteVisitor(SE), LoopMap(LoopMap) {}
+
+  const SCEV *visitAddRecExpr(const SCEVAddRecExpr *Expr) {
+    SmallVector<const SCEV *, 2> Operands;
+    for (const SCEV *Op : Expr->operands()) {
+      Operands.push_back(visit(Op));
+    }
+
+    const Loop *L = LoopMap.lookup(Expr->getLoop());
+    return SE.getAddRecExpr(Operands, L ? L : Expr->getLoop(),
+                            SCEV::FlagAnyWrap);
+  }
+
+  // I flag vanno letti sulla ricorrenza originale: quella riscritta li perde
+  const SCEV *visitSignExtendExpr(const SCEVSignExtendExpr *Expr) {
+    auto *AddRec = dyn_cast<SCEVAddRecExpr>(Expr->getOperand());
+    if (!AddRec || !AddRec->isAffine() || !AddRec->hasNoSignedWrap()) {
+      return SE.getSignExtendExpr(visit(Expr->getOperand()),
+                                  Expr->getType());
+    }
+
+    auto *Rewritten = cast<SCEVAddRecExpr>(visit(AddRec));
+    return SE.getAddRecExpr(
+        SE.getSignExtendExpr(Rewritten->getStart(), Expr->getType()),
+        SE.getSignExtendExpr(Rewritten->getStepRecurrence(SE),
+                             Expr->getType()),
+        Rewritten->getLoop(), SCEV::FlagAnyWrap);
+  }
+
+  const SCEV *visitZeroExtendExpr(const SCEVZeroExtendExpr *Expr) {
+    auto *AddRec = dyn_cast<SCEVAddRecExpr>(Expr->getOperand());
+    if (!AddRec || !AddRec->isAffine() || !AddRec->hasNoUnsignedWrap()) {
+      return SE.getZeroExtendExpr(visit(Expr->getOperand()),
+                                  Expr->getType());
+    }
+
+    auto *Rewritten = cast<SCEVAddRecExpr>(visit(AddRec));
+    return SE.getAddRecExpr(
+        SE.getZeroExtendExpr(Rewritten->getStart(), Expr->getType()),
+        SE.getZeroExtendExpr(Rewritten->getStepRecurrence(SE),
+                             Expr->getType()),
+        Rewritten->getLoop(), SCEV::FlagAnyWrap);
+  }
+};
+
+// Ogni loop dei due nidi corrisponde al primo loop di L1 alla stessa
+// profondità, come se i nidi fossero già fusi a ogni livello. I loop
+// interni di un nido fuso in precedenza non sono ancora fusi tra loro, ma
+// accedono agli stessi indirizzi.
+DenseMap<const Loop *, const Loop *> getFusedLoopMap(Loop *L1, Loop *L2) {
+  DenseMap<const Loop *, const Loop *> LoopMap;
+  SmallVector<const Loop *, 4> FirstAtDepth;
+  for (Loop *Root : {L1, L2}) {
+    for (Loop *Inner : Root->getLoopsInPreorder()) {
+      unsigned Depth = Inner->getLoopDepth() - Root->getLoopDepth();
+      if (Depth == FirstAtDepth.size()) {
+        FirstAtDepth.push_back(Inner);
+      }
+      if (Depth < FirstAtDepth.size()) {
+        LoopMap[Inner] = FirstAtDepth[Depth];
+      }
+    }
+  }
+
+  return LoopMap;
+}
+
+// DI non analizza le chiamate e le considera sempre dipendenti: basta che
+// uno dei due accessi scriva in memoria
+bool conflictsWithUnknown(ArrayRef<Instruction *> Unknown,
+                          const LoopMemoryAccesses &Other) {
+  for (Instruction *I0 : Unknown) {
+    for (Instruction *I1 : Other.Unknown) {
+      if (I0->mayWriteToMemory() || I1->mayWriteToMemory()) {
+        return true;
+      }
+    }
+
+    for (const auto &[Object, Insts] : Other.ByObject) {
+      for (Instruction *I1 : Insts) {
+        if (I0->mayWriteToMemory() || I1->mayWriteToMemory()) {
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+// Sposta di Shift iterazioni le AddRec affini di un loop: gli indirizzi
+// di un'iterazione si confrontano con quelli di un'iterazione successiva
+class AddRecShifter : public SCEVRewriteVisitor<AddRecShifter> {
+  const Loop *L;
+  int64_t Shift;
+
+public:
+  AddRecShifter(ScalarEvolution &SE, const Loop *L, int64_t Shift)
+      : SCEVRewriteVisitor(SE), L(L), Shift(Shift) {}
+
+  const SCEV *visitAddRecExpr(const SCEVAddRecExpr *Expr) {
+    SmallVector<const SCEV *, 2> Operands;
+    for (const SCEV *Op : Expr->operands()) {
+      Operands.push_back(visit(Op));
+    }
+
+    if (Expr->getLoop() != L || !Expr->isAffine()) {
+      return SE.getAddRecExpr(Operands, Expr->getLoop(), SCEV::FlagAnyWrap);
+    }
+
+    const SCEV *Step = Operands[1];
+    const SCEV *Start = SE.getAddExpr(
+        Operands[0],
+        SE.getMulExpr(SE.getConstant(Step->getType(), Shift), Step));
+    return SE.getAddRecExpr(Start, Step, L, SCEV::FlagAnyWrap);
+  }
+};
+
+// Confronto degli accessi nello spazio di iterazione del loop fuso
+struct FusedIterationSpace {
+  Loop *L1;
+  // Iterazioni staccate in testa a L1: l'iterazione k del loop fuso
+  // esegue l'iterazione k + PeelCount di L1
+  int64_t PeelCount;
+  ScalarEvolution &SE;
+  AddRecLoopReplacer &Replacer;
+  // Per l'unroll-and-jam L2 è una copia di L1 eseguita OuterShift
+  // iterazioni dopo del loop esterno Outer
+  const Loop *Outer = nullptr;
+  int64_t OuterShift = 0;
+};
+
+// Dopo la fusione, all'iterazione k, un accesso di L2 non deve toccare
+// memoria che L1 tocca a un'iterazione successiva. Con le AddRec di L2
+// riscritte su L1, i due indirizzi devono differire di una costante D e
+// avanzare dello stesso passo S a ogni iterazione di L1. Se i loop interni
+// coprono l'intervallo [Lo, Hi] attorno all'indirizzo e S > 0, l'accesso
+// di L2 deve finire prima dell'intervallo di L1 all'iterazione k + 1, da
+// cui le successive si allontanano ancora:
+//   D + Hi - Lo + dimensione dell'accesso di L2 <= S
+// e simmetricamente con S < 0. Vale anche per D = 0: in un nest su
+// A[i + j] L2 legge alla stessa iterazione anche elementi che L1 scrive
+// solo alle iterazioni successive. Le induzioni dei due loop possono
+// partire da valori diversi: la differenza finisce in D. Se l'indirizzo
+// non dipende da L1, gli intervalli dei due accessi devono essere
+// disgiunti.
+bool overlapsLaterIteration(Instruction *I1, Instruction *I2,
+                            const FusedIterationSpace &Space) {
+  ScalarEvolution &SE = Space.SE;
+  const SCEV *Ptr1 =
+      Space.Replacer.visit(SE.getSCEV(getLoadStorePointerOperand(I1)));
+  const SCEV *Ptr2 =
+      Space.Replacer.visit(SE.getSCEV(getLoadStorePointerOperand(I2)));
+  if (Space.OuterShift) {
+    Ptr2 = AddRecShifter(SE, Space.Outer, Space.OuterShift).visit(Ptr2);
+  }
+  auto *Distance = dyn_cast<SCEVConstant>(SE.getMinusSCEV(Ptr2, Ptr1));
+  if (!Distance || Distance->getAPInt().abs().ugt(INT32_MAX)) {
+    return true;
+  }
+
+  int64_t Lo = 0, Hi = 0;
+  bool isExtentKnown = true;
+  const SCEV *Base = Ptr1;
+  const auto *AddRec = dyn_cast<SCEVAddRecExpr>(Base);
+  while (AddRec && AddRec->getLoop() != Space.L1 &&
+         Space.L1->contains(AddRec->getLoop())) {
+    auto *Step = dyn_cast<SCEVConstant>(AddRec->getStepRecurrence(SE));
+    auto *MaxBackedges = dyn_cast<SCEVConstant>(
+        SE.getConstantMaxBackedgeTakenCount(AddRec->getLoop()));
+    if (!AddRec->isAffine() || !Step || !MaxBackedges ||
+        Step->getAPInt().abs().ugt(INT32_MAX) ||
+        MaxBackedges->getAPInt().ugt(INT32_MAX)) {
+      isExtentKnown = false;
+    } else {
+      int64_t Extent =
+          Step->getAPInt().getSExtValue() *
+          static_cast<int64_t>(MaxBackedges->getAPInt().getZExtValue());
+      (Extent > 0 ? Hi : Lo) += Extent;
+    }
+    Base = AddRec->getStart();
+    AddRec = dyn_cast<SCEVAddRecExpr>(Base);
+  }
+
+  const DataLayout &DL = I1->getModule()->getDataLayout();
+  int64_t SizeL1 = DL.getTypeStoreSize(getLoadStoreType(I1));
+  int64_t SizeL2 = DL.getTypeStoreSize(getLoadStoreType(I2));
+
+  // Un indirizzo invariante in L1 viene toccato a ogni iterazione: i due
+  // accessi non devono mai sovrapporsi
+  if (!AddRec || AddRec->getLoop() != Space.L1) {
+    if (!isExtentKnown || !SE.isLoopInvariant(Base, Space.L1)) {
+      return true;
+    }
+    int64_t D = Distance->getAPInt().getSExtValue();
+    return D < Hi - Lo + SizeL1 && D + Hi - Lo + SizeL2 > 0;
+  }
+  auto *Step = dyn_cast<SCEVConstant>(AddRec->getStepRecurrence(SE));
+  if (!AddRec->isAffine() || !Step || Step->isZero() ||
+      Step->getAPInt().abs().ugt(INT32_MAX)) {
+    return true;
+  }
+
+  int64_t S = Step->getAPInt().getSExtValue();
+  int64_t D = Distance->getAPInt().getSExtValue() - Space.PeelCount * S;
+  if (!isExtentKnown) {
+    return true;
+  }
+  if (S > 0) {
+    return D + Hi - Lo + SizeL2 > S;
+  }
+  return D < S + Hi - Lo + SizeL1;
+}
+
+bool hasNegativeDependence(ArrayRef<Instruction *> InstsL1,
+                           ArrayRef<Instruction *> InstsL2,
+                           DependenceInfo &DI,
+                           const FusedIterationSpace &Space) {
+  for (Instruction *I0 : InstsL1) {
+    for (Instruction *I1 : InstsL2) {
+      // Due letture non creano dipendenze
+      if (!I0->mayWriteToMemory() && !I1->mayWriteToMemory()) {
+        continue;
+      }
+
+      // DI confronta i loop fratelli come se le loro induzioni fossero
+      // indipendenti: esclude le dipendenze, ma non dice a quale iterazione
+      // del loop fuso si incontrano
+      if (DI.depends(I0, I1, true) && overlapsLaterIteration(I0, I1, Space)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+bool hasNegativeDistance(const LoopMemoryAccesses &AccessesL1,
+                         const LoopMemoryAccesses &AccessesL2,
+                         DependenceInfo &DI,
+                         const FusedIterationSpace &Space) {
+  if (conflictsWithUnknown(AccessesL1.Unknown, AccessesL2) ||
+      conflictsWithUnknown(AccessesL2.Unknown, AccessesL1)) {
+    return true;
+  }
+
+  // Verifico le dipendenze solo tra gli accessi che possono sovrapporsi:
+  // un oggetto identificato di L2 si confronta con lo stesso oggetto e con
+  // gli oggetti non identificati di L1, uno non identificato con tutti
+  for (const auto &[O2, InstsL2] : AccessesL2.ByObject) {
+    if (!isIdentifiedObject(O2)) {
+      for (const auto &[O1, InstsL1] : AccessesL1.ByObject) {
+        if (hasNegativeDependence(InstsL1, InstsL2, DI, Space)) {
+          return true;
+        }
+      }
+      continue;
+    }
+
+    auto Same = AccessesL1.ByObject.find(O2);
+    if (Same != AccessesL1.ByObject.end() &&
+        hasNegativeDependence(Same->second, InstsL2, DI, Space)) {
+      return true;
+    }
+
+    for (const Value *O1 : AccessesL1.Unidentified) {
+      if (hasNegativeDependence(AccessesL1.ByObject.find(O1)->second, InstsL2,
+                                DI, Space)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
 }
 
-bool areLoopDistanceNegative(Loop *L1, Loop *L2, DependenceInfo &DI) {
+bool areLoopDistanceNegative(Loop *L1, Loop *L2, int64_t PeelCount,
+                             DependenceInfo &DI, ScalarEvolution &SE,
+                             DependenceCache &Cache) {
   // A negative distance dependence occurs between Lj and Lk, Lj before Lk,
   // when at iteration m from Lk uses a value that is computed by Lj at a future
   // iteration m+n (where n > 0).
+  auto [It, Inserted] = Cache.NegativeDistance.try_emplace({L1, L2});
+  if (Inserted) {
+    // Le ultime iterazioni staccate da L2 vengono eseguite dopo il loop
+    // fuso: conta solo lo spostamento di L1
+    DenseMap<const Loop *, const Loop *> LoopMap = getFusedLoopMap(L1, L2);
+    AddRecLoopReplacer Replacer(SE, LoopMap);
+    FusedIterationSpace Space = {L1, max<int64_t>(PeelCount, 0), SE,
+                                 Replacer};
+    It->second = hasNegativeDistance(getMemoryAccesses(L1, Cache),
+                                     getMemoryAccesses(L2, Cache), DI, Space);
+  }
+
+  return It->second;
+}
+
+// Istruzioni tra l'uscita di L1 e il preheader di L2, che la fusione
+// renderebbe irraggiungibili: vengono spostate prima di L1 o dopo L2
+struct InterveningCode {
+  // Blocchi in linea retta dall'uscita di L1 al preheader di L2
+  SmallVector<BasicBlock *, 4> Blocks;
+  // In ordine di programma, per essere spostate senza riordinarle
+  SmallVector<Instruction *, 8> Hoisted;
+  SmallVector<Instruction *, 8> Sunk;
+
+  size_t size() const { return Hoisted.size() + Sunk.size(); }
+};
+
+// Un accesso spostato non deve sovrapporsi a quelli che scavalca: una
+// lettura a una scrittura, una scrittura a qualsiasi accesso
+bool conflictsWithAccess(Instruction *I, ArrayRef<Instruction *> Others,
+                         AAResults &AA) {
+  MemoryLocation Loc = MemoryLocation::get(I);
+  for (Instruction *Other : Others) {
+    ModRefInfo MR = AA.getModRefInfo(Other, Loc);
+    if (I->mayWriteToMemory() ? isModOrRefSet(MR) : isModSet(MR)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool conflictsWithLoop(Instruction *I, const LoopMemoryAccesses &Accesses,
+                       AAResults &AA) {
+  if (conflictsWithAccess(I, Accesses.Unknown, AA)) {
+    return true;
+  }
+
+  for (const auto &[Object, Insts] : Accesses.ByObject) {
+    if (conflictsWithAccess(I, Insts, AA)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Cerca il codice tra due loop non adiacenti e decide dove spostarlo; i
+// blocchi restano in Code anche se il codice non si può spostare. Ogni
+// istruzione, in ordine, sale prima di L1 se non usa valori di L1 né
+// istruzioni che scendono, e non tocca la memoria di L1 o di quelle che
+// scendono; altrimenti scende dopo L2 se L2 non usa il suo valore e non
+// tocca la stessa memoria. Si spostano solo calcoli senza effetti
+// collaterali e load e store non atomici e non volatili.
+bool getInterveningCode(Loop *L1, Loop *L2, DependenceCache &Cache,
+                        AAResults &AA, InterveningCode &Code) {
+  // Il codice tra la guardia di L1 e l'ingresso di L2 non viene spostato
+  if (L1->isGuarded() || L2->isGuarded()) {
+    return false;
+  }
+
+  BasicBlock *PreheaderL2 = L2->getLoopPreheader();
+  BasicBlock *ExitBlockL2 = L2->getExitBlock();
+  SmallVector<BasicBlock *, 4> &Blocks = Code.Blocks;
+  for (BasicBlock *BB = L1->getExitBlock(); BB;
+       BB = BB->getSingleSuccessor()) {
+    // Ogni blocco viene eseguito una volta dopo L1 e prima di L2
+    if (!BB->getSinglePredecessor() || !BB->getSingleSuccessor() ||
+        isa<PHINode>(BB->front()) || L2->contains(BB)) {
+      Blocks.clear();
+      return false;
+    }
+
+    Blocks.push_back(BB);
+    if (BB == PreheaderL2) {
+      break;
+    }
+  }
+  if (Blocks.empty() || Blocks.back() != PreheaderL2) {
+    Blocks.clear();
+    return false;
+  }
+
+  SmallPtrSet<Instruction *, 8> Sunk;
+  SmallVector<Instruction *, 8> SunkAccesses;
+  for (BasicBlock *BB : Blocks) {
+    for (Instruction &I : BB->instructionsWithoutDebug()) {
+      if (I.isTerminator()) {
+        continue;
+      }
+
+      bool isAccess = I.mayReadOrWriteMemory();
+      if (isAccess ? !isa<LoadInst, StoreInst>(I) || I.isAtomic() ||
+                         I.isVolatile()
+                   : I.mayHaveSideEffects()) {
+        return false;
+      }
+
+      // Una divisione per zero salita prima di L1 fallirebbe prima degli
+      // effetti di L1: i calcoli che possono fallire scendono dopo L2
+      bool CanHoist =
+          (isAccess || isSafeToSpeculativelyExecute(&I)) &&
+          none_of(I.operands(),
+                  [&](Value *Op) {
+                    auto *OpI = dyn_cast<Instruction>(Op);
+                    return OpI && (L1->contains(OpI) || Sunk.count(OpI));
+                  }) &&
+          (!isAccess ||
+           (!conflictsWithLoop(&I, getMemoryAccesses(L1, Cache), AA) &&
+            !conflictsWithAccess(&I, SunkAccesses, AA)));
+      if (CanHoist) {
+        Code.Hoisted.push_back(&I);
+        continue;
+      }
+
+      // Gli usi dopo L2 sono dominati dalla sua uscita, tranne le phi
+      // dell'uscita stessa, che ricevono il valore dall'header di L2
+      bool CanSink =
+          none_of(I.users(),
+                  [&](User *U) {
+                    auto *UI = cast<Instruction>(U);
+                    return L2->contains(UI) ||
+                           (isa<PHINode>(UI) && UI->getParent() == ExitBlockL2);
+                  }) &&
+          (!isAccess ||
+           !conflictsWithLoop(&I, getMemoryAccesses(L2, Cache), AA));
+      if (!CanSink) {
+        return false;
+      }
+
+      Code.Sunk.push_back(&I);
+      Sunk.insert(&I);
+      if (isAccess) {
+        SunkAccesses.push_back(&I);
+      }
+    }
+  }
+
+  return true;
+}
+
+// Sposta il codice nel preheader di L1 e all'inizio dell'uscita di L2: i
+// blocchi tra i due loop restano vuoti e i loop diventano adiacenti
+void moveInterveningCode(Loop *L1, Loop *L2, const InterveningCode &Code,
+                         ScalarEvolution &SE) {
+  Instruction *HoistPt = L1->getLoopPreheader()->getTerminator();
+  for (Instruction *I : Code.Hoisted) {
+    I->moveBefore(HoistPt);
+  }
+
+  Instruction *SinkPt = &*L2->getExitBlock()->getFirstInsertionPt();
+  for (Instruction *I : Code.Sunk) {
+    I->moveBefore(SinkPt);
+  }
 
-  vector<Instruction *> InstructionsL1;
-  vector<Instruction *> InstructionsL2;
+  // I debug intrinsic rimasti non descrivono più niente
+  for (BasicBlock *BB : Code.Blocks) {
+    while (&BB->front() != BB->getTerminator()) {
+      BB->front().eraseFromParent();
+    }
+  }
+
+  // Le istruzioni spostate dominano blocchi diversi
+  SE.forgetBlockAndLoopDispositions();
+}
+
+// Le phi dell'header di L2 vengono ricalcolate da un'induzione di L1: devono
+// essere ricorrenze affini di L2, con inizio e passo noti prima di L1
+bool areInductionsAffine(Loop *L2, Loop *L1, ScalarEvolution &SE) {
+  for (PHINode &Phi : L2->getHeader()->phis()) {
+    if (!SE.isSCEVable(Phi.getType())) {
+      return false;
+    }
+
+    auto *AddRec = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&Phi));
+    if (!AddRec || AddRec->getLoop() != L2 || !AddRec->isAffine() ||
+        !SE.isLoopInvariant(AddRec->getStart(), L1) ||
+        !SE.isLoopInvariant(AddRec->getStepRecurrence(SE), L1)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Stima del guadagno della fusione, in cicli per iterazione: il riuso dei
+// dati tra i due corpi meno gli spill dei registri in più e la perdita
+// della vettorizzazione
+struct FusionScore {
+  int Reuse = 0;
+  int RegisterPressure = 0;
+  int Vectorization = 0;
+
+  int total() const { return Reuse - RegisterPressure - Vectorization; }
+};
+
+void appendScore(DiagnosticInfoOptimizationBase &Remark,
+                 const FusionScore &Score) {
+  Remark << " (score " << ore::NV("Score", Score.total()) << ": reuse "
+         << ore::NV("Reuse", Score.Reuse) << ", register pressure "
+         << ore::NV("RegisterPressure", -Score.RegisterPressure)
+         << ", vectorization "
+         << ore::NV("Vectorization", -Score.Vectorization) << ")";
+}
 
-  // Aggiungo le istruzioni di L1 e L2 ai due vettori
-  for (BasicBlock *BB : L1->blocks()) {
+// Registri occupati da un loop: gli invarianti che usa e i valori
+// definiti nel loop che servono fuori dal loro blocco o tra un'iterazione
+// e l'altra. Gli invarianti sono restituiti a parte, perché quelli comuni
+// ai due loop occupano un solo registro nel loop fuso.
+unsigned getLiveValues(Loop *L, SmallPtrSetImpl<Value *> &Invariants) {
+  unsigned Variants = 0;
+  for (BasicBlock *BB : L->blocks()) {
     for (Instruction &I : *BB) {
-      InstructionsL1.push_back(&I);
+      for (Value *Op : I.operands()) {
+        if ((isa<Instruction>(Op) || isa<Argument>(Op)) &&
+            L->isLoopInvariant(Op)) {
+          Invariants.insert(Op);
+        }
+      }
+
+      if (isa<PHINode>(I) || I.isUsedOutsideOfBlock(BB)) {
+        ++Variants;
+      }
     }
   }
 
-  for (BasicBlock *BB : L2->blocks()) {
+  return Variants;
+}
+
+// Un loop interno senza chiamate, con accessi contigui o invarianti e
+// senza phi oltre alle induzioni è un buon candidato per il vettorizzatore.
+// Restituisce la dimensione massima degli accessi, 0 se non lo è.
+uint64_t getVectorizableAccessSize(Loop *L,
+                                   const LoopMemoryAccesses &Accesses,
+                                   ScalarEvolution &SE, const DataLayout &DL) {
+  if (!L->isInnermost() || !Accesses.Unknown.empty() ||
+      !areInductionsAffine(L, L, SE)) {
+    return 0;
+  }
+
+  for (BasicBlock *BB : L->blocks()) {
     for (Instruction &I : *BB) {
-      InstructionsL2.push_back(&I);
+      if (isa<CallBase>(I) && !isa<IntrinsicInst>(I)) {
+        return 0;
+      }
+    }
+  }
+
+  uint64_t MaxSize = 1;
+  for (const auto &[Object, Insts] : Accesses.ByObject) {
+    for (Instruction *I : Insts) {
+      uint64_t Size = DL.getTypeStoreSize(getLoadStoreType(I));
+      const SCEV *Ptr = SE.getSCEV(getLoadStorePointerOperand(I));
+      auto *AddRec = dyn_cast<SCEVAddRecExpr>(Ptr);
+      if (AddRec && AddRec->getLoop() == L) {
+        auto *Step = dyn_cast<SCEVConstant>(AddRec->getStepRecurrence(SE));
+        if (!AddRec->isAffine() || !Step ||
+            Step->getAPInt().abs() != Size) {
+          return 0;
+        }
+      } else if (!SE.isLoopInvariant(Ptr, L)) {
+        return 0;
+      }
+      MaxSize = max(MaxSize, Size);
     }
   }
 
-  // Verifico le dipendenze tra le istruzioni di L1 e L2
-  for (Instruction *I0 : InstructionsL1) {
-    // Verifico se c'è una dipendenza tra I0 e tutte le istruzioni in L2
-    for (Instruction *I1 : InstructionsL2) {
-      auto dep = DI.depends(I0, I1, true);
+  return MaxSize;
+}
 
-      if (!dep) {
-        continue;
+InstructionCost getLoopCost(Loop *L, const TargetTransformInfo &TTI) {
+  InstructionCost Cost = 0;
+  for (BasicBlock *BB : L->blocks()) {
+    for (Instruction &I : *BB) {
+      Cost += TTI.getInstructionCost(
+          &I, TargetTransformInfo::TCK_RecipThroughput);
+    }
+  }
+  return Cost;
+}
+
+FusionScore getFusionScore(Loop *L1, Loop *L2,
+                           const LoopMemoryAccesses &AccessesL1,
+                           const LoopMemoryAccesses &AccessesL2,
+                           ScalarEvolution &SE,
+                           const TargetTransformInfo &TTI) {
+  const DataLayout &DL = L1->getHeader()->getModule()->getDataLayout();
+  FusionScore Score;
+
+  // Un accesso di L2 riusa i dati di L1 se tocca lo stesso oggetto a una
+  // distanza, in byte percorsi dal loop fuso, che sta nella cache L1
+  uint64_t BytesPerIteration = 0;
+  for (const LoopMemoryAccesses *Accesses : {&AccessesL1, &AccessesL2}) {
+    for (const auto &[Object, Insts] : Accesses->ByObject) {
+      for (Instruction *I : Insts) {
+        BytesPerIteration += DL.getTypeStoreSize(getLoadStoreType(I));
       }
+    }
+  }
+  uint64_t CacheSize = 32 * 1024;
+  if (auto Size =
+          TTI.getCacheSize(TargetTransformInfo::CacheLevel::L1D)) {
+    CacheSize = *Size;
+  }
+  uint64_t MaxDistance = CacheSize / max<uint64_t>(BytesPerIteration, 1);
 
-      // Se c'è una dipendenza, la distanza è negativa
-      if (dep->isAnti() || dep->isConfused()) {
-        return true;
+  DenseMap<const Loop *, const Loop *> LoopMap = getFusedLoopMap(L1, L2);
+  AddRecLoopReplacer Replacer(SE, LoopMap);
+
+  // La distanza in iterazioni è la distanza in byte tra gli indirizzi
+  // divisa per la dimensione dell'accesso, come per un accesso contiguo
+  for (const auto &[Object, InstsL2] : AccessesL2.ByObject) {
+    auto Same = AccessesL1.ByObject.find(Object);
+    if (Same == AccessesL1.ByObject.end()) {
+      continue;
+    }
+
+    for (Instruction *I2 : InstsL2) {
+      const SCEV *Ptr2 =
+          Replacer.visit(SE.getSCEV(getLoadStorePointerOperand(I2)));
+      if (any_of(Same->second, [&](Instruction *I1) {
+            auto *Distance = dyn_cast<SCEVConstant>(SE.getMinusSCEV(
+                Replacer.visit(SE.getSCEV(getLoadStorePointerOperand(I1))),
+                Ptr2));
+            uint64_t Size = DL.getTypeStoreSize(getLoadStoreType(I1));
+            return Distance &&
+                   Distance->getAPInt().abs().getLimitedValue() / Size <=
+                       MaxDistance;
+          })) {
+        Score.Reuse += ReuseGain;
       }
     }
   }
 
-  return false;
+  // I registri oltre a quelli disponibili, e oltre a quelli che già
+  // servono a uno dei due loop, finiscono in memoria
+  SmallPtrSet<Value *, 16> InvariantsL1, InvariantsL2;
+  unsigned LiveL1 = getLiveValues(L1, InvariantsL1);
+  unsigned LiveL2 = getLiveValues(L2, InvariantsL2);
+  unsigned PressureL1 = LiveL1 + InvariantsL1.size();
+  unsigned PressureL2 = LiveL2 + InvariantsL2.size();
+  InvariantsL1.insert(InvariantsL2.begin(), InvariantsL2.end());
+  // L'induzione di L2 viene sostituita da quella di L1
+  unsigned Pressure = LiveL1 + LiveL2 - 1 + InvariantsL1.size();
+  unsigned Registers =
+      TTI.getNumberOfRegisters(TTI.getRegisterClassForType(false));
+  unsigned Available = max({Registers, PressureL1, PressureL2});
+  if (Pressure > Available) {
+    Score.RegisterPressure = (Pressure - Available) * SpillCost;
+  }
+
+  // Se solo uno dei due loop è vettorizzabile, il loop fuso non lo è più:
+  // il suo corpo costa VF volte di più
+  uint64_t SizeL1 = getVectorizableAccessSize(L1, AccessesL1, SE, DL);
+  uint64_t SizeL2 = getVectorizableAccessSize(L2, AccessesL2, SE, DL);
+  if (!SizeL1 != !SizeL2) {
+    Loop *Vectorizable = SizeL1 ? L1 : L2;
+    uint64_t VectorBits =
+        TTI.getRegisterBitWidth(TargetTransformInfo::RGK_FixedWidthVector)
+            .getFixedValue();
+    uint64_t VF = VectorBits / (8 * max(SizeL1, SizeL2));
+    if (VF > 1) {
+      if (auto Cost = getLoopCost(Vectorizable, TTI).getValue()) {
+        Score.Vectorization = static_cast<int>(*Cost - *Cost / VF);
+      }
+    }
+  }
+
+  return Score;
+}
+
+// L'header di un loop fuso nel precedente viene eliminato: oltre alle phi
+// deve contenere solo il controllo di uscita, usato solo nell'header
+bool isHeaderOnlyControl(Loop *L) {
+  BasicBlock *Header = L->getHeader();
+
+  for (Instruction &I : *Header) {
+    if (isa<PHINode>(I) || I.isTerminator()) {
+      continue;
+    }
+
+    for (User *U : I.users()) {
+      if (cast<Instruction>(U)->getParent() != Header) {
+        return false;
+      }
+    }
+  }
+
+  return true;
 }
 
-list<Loop *> getMergeableLoops(LoopInfo *LI) {
+// Le iterazioni staccate da un loop sono copie del corpo senza l'header:
+// il loop deve essere interno, l'header non deve avere effetti oltre al
+// controllo di uscita, l'unica phi deve essere l'induzione canonica e il
+// suo incremento deve stare nel corpo
+bool canPeelLoop(Loop *L) {
+  PHINode *IV = L->getCanonicalInductionVariable();
+  BasicBlock *Header = L->getHeader();
+  if (!IV || !L->isInnermost() || !isHeaderOnlyControl(L) ||
+      !L->getLoopLatch()->getSingleSuccessor() ||
+      any_of(Header->phis(), [&](PHINode &Phi) { return &Phi != IV; })) {
+    return false;
+  }
+
+  auto *Inc = cast<Instruction>(IV->getIncomingValueForBlock(L->getLoopLatch()));
+  if (Inc->getParent() == Header) {
+    return false;
+  }
+
+  return none_of(*Header,
+                 [](Instruction &I) { return I.mayHaveSideEffects(); });
+}
+
+// Iterazioni da staccare per fondere due loop interni i cui trip count
+// differiscono di una costante: positivo se L1 è più lungo, negativo se lo
+// è L2, 0 se la differenza non è costante o è troppo grande. Una differenza
+// invariante ma non costante (n e n + m) non è gestita: il numero di copie
+// e le distanze del controllo delle dipendenze, spostate di quel numero,
+// devono essere noti a tempo di compilazione. SCEV calcola la differenza
+// modulo 2^n: è esatta solo se sommarla al trip count del loop più corto
+// non va in overflow, e deve dimostrarlo all'ingresso del loop più lungo,
+// ad esempio da una guardia sul bound.
+int64_t getPeelCount(Loop *L1, Loop *L2, ScalarEvolution &SE) {
+  if (!MaxPeelCount || !L1->isInnermost() || !L2->isInnermost()) {
+    return 0;
+  }
+
+  PHINode *IVL1 = L1->getCanonicalInductionVariable();
+  PHINode *IVL2 = L2->getCanonicalInductionVariable();
+  if (!IVL1 || !IVL2 || IVL1->getType() != IVL2->getType()) {
+    return 0;
+  }
+
+  const SCEV *ExitCount1 = SE.getExitCount(L1, L1->getExitingBlock());
+  const SCEV *ExitCount2 = SE.getExitCount(L2, L2->getExitingBlock());
+  if (isa<SCEVCouldNotCompute>(ExitCount1) ||
+      isa<SCEVCouldNotCompute>(ExitCount2) ||
+      ExitCount1->getType() != ExitCount2->getType()) {
+    return 0;
+  }
+
+  auto *Difference =
+      dyn_cast<SCEVConstant>(SE.getMinusSCEV(ExitCount1, ExitCount2));
+  if (!Difference || Difference->isZero() ||
+      Difference->getAPInt().abs().ugt(MaxPeelCount)) {
+    return 0;
+  }
+
+  int64_t PeelCount = Difference->getAPInt().getSExtValue();
+  Loop *Longer = PeelCount > 0 ? L1 : L2;
+  const SCEV *ShorterExitCount = PeelCount > 0 ? ExitCount2 : ExitCount1;
+  APInt MaxShorterExitCount =
+      APInt::getMaxValue(SE.getTypeSizeInBits(ShorterExitCount->getType())) -
+      abs(PeelCount);
+  if (!SE.isLoopEntryGuardedByCond(Longer, ICmpInst::ICMP_ULE,
+                                   ShorterExitCount,
+                                   SE.getConstant(MaxShorterExitCount)) ||
+      !canPeelLoop(Longer)) {
+    return 0;
+  }
+
+  return PeelCount;
+}
+
+// Filtra i loop di uno stesso livello (top-level o figli dello stesso
+// loop), in ordine di programma, tenendo quelli con la struttura richiesta
+bool hasFusionShape(Loop *L) {
+  return L->getLoopPreheader() && L->getHeader() && L->getLoopLatch() &&
+         L->getExitingBlock() == L->getHeader() && L->getExitBlock() &&
+         L->isLoopSimplifyForm();
+}
+
+list<Loop *> getMergeableSiblings(ArrayRef<Loop *> Siblings,
+                                  OptimizationRemarkEmitter &ORE) {
   list<Loop *> MergeableLoops;
 
-  for (Loop *TopLevelLoop : *LI) {
+  for (Loop *L : Siblings) {
     // Controllo che il loop abbia i blocchi e le strutture necessarie per
     // considerarlo valido:
     //  - Preheader: blocco che precede l'ingresso del loop
     //  - Header: blocco che definisce l'inizio del loop
     //  - Latch: blocco che permette di tornare all'inizio del loop
-    //  - ExitingBlock: blocco che esce dal loop
+    //  - ExitingBlock: blocco che esce dal loop, deve essere l'header
     //  - ExitBlock: blocco successivo al loop
     //  - Simply form: verifico se il loop è nella forma semplificata
-    if (TopLevelLoop->isInnermost()) {
-      if (!TopLevelLoop->getLoopPreheader() || !TopLevelLoop->getHeader() ||
-          !TopLevelLoop->getLoopLatch() || !TopLevelLoop->getExitingBlock() ||
-          !TopLevelLoop->getExitBlock() ||
-          !TopLevelLoop->isLoopSimplifyForm()) {
-        outs() << "Loop not mergeable \n";
-        continue;
+    if (!hasFusionShape(L)) {
+      ++NumNotMergeable;
+      ORE.emit([&]() {
+        return OptimizationRemarkMissed(DEBUG_TYPE, "NotMergeable",
+                                        L->getStartLoc(), L->getHeader())
+               << "loop not considered for fusion: missing preheader, "
+                  "latch or single exit in the header, or not in simplify "
+                  "form";
+      });
+      continue;
+    }
+
+    MergeableLoops.push_back(L);
+  }
+
+  return MergeableLoops;
+}
+
+// Figli di Parent in ordine di programma, o i loop top-level se Parent è
+// nullo: i loop top-level sono in ordine inverso in LoopInfo
+SmallVector<Loop *, 8> getSiblingLoops(Loop *Parent, LoopInfo &LI) {
+  if (Parent) {
+    return SmallVector<Loop *, 8>(Parent->begin(), Parent->end());
+  }
+
+  return SmallVector<Loop *, 8>(LI.rbegin(), LI.rend());
+}
+
+// Dopo la fusione l'uscita di L1, il preheader, l'header e il latch di L2
+// non sono più raggiungibili: vengono tolti da LoopInfo e cancellati. La
+// ricerca parte da questi blocchi e si ferma ai blocchi di L1 e
+// all'uscita di L2, senza visitare tutta la funzione.
+void deleteUnreachableBlocks(ArrayRef<BasicBlock *> Roots, Loop *L1,
+                             BasicBlock *ExitBlock, LoopInfo &LI,
+                             DomTreeUpdater &DTU) {
+  SmallSetVector<BasicBlock *, 8> Region;
+  SmallVector<BasicBlock *, 8> Worklist(Roots.begin(), Roots.end());
+  while (!Worklist.empty()) {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (L1->contains(BB) || BB == ExitBlock || !Region.insert(BB)) {
+      continue;
+    }
+    append_range(Worklist, successors(BB));
+  }
+
+  // Un blocco della regione è vivo se ha un predecessore fuori dalla
+  // regione, o se lo raggiunge un blocco vivo
+  SmallPtrSet<BasicBlock *, 8> Live;
+  for (BasicBlock *BB : Region) {
+    if (BB->isEntryBlock() || any_of(predecessors(BB), [&](BasicBlock *Pred) {
+          return !Region.contains(Pred);
+        })) {
+      Worklist.push_back(BB);
+    }
+  }
+  while (!Worklist.empty()) {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (!Live.insert(BB).second) {
+      continue;
+    }
+    for (BasicBlock *Succ : successors(BB)) {
+      if (Region.contains(Succ)) {
+        Worklist.push_back(Succ);
       }
+    }
+  }
 
-      MergeableLoops.push_front(TopLevelLoop);
+  SmallVector<BasicBlock *, 8> DeadBlocks;
+  for (BasicBlock *BB : Region) {
+    if (!Live.count(BB)) {
+      DeadBlocks.push_back(BB);
+      LI.removeBlock(BB);
     }
   }
 
-  return MergeableLoops;
+  DeleteDeadBlocks(DeadBlocks, &DTU);
 }
 
-bool fuseLoops(Loop *L1, Loop *L2, LoopInfo &LI) {
-  // Modificare gli usi della induction variable nel body del
-  // loop 2 con quelli della induction variable del loop 1
-  PHINode *ivL1 = L1->getCanonicalInductionVariable();
-  PHINode *ivL2 = L2->getCanonicalInductionVariable();
+// Stacca Count iterazioni da L, copiando il corpo senza l'header una volta
+// per iterazione: le ultime vanno tra l'header e l'uscita (AtEnd), le prime
+// tra il preheader e l'header. Il latch di ogni copia salta alla copia
+// successiva, e l'induzione di una copia è l'incremento della precedente.
+void peelIterations(Loop *L, unsigned Count, bool AtEnd, LoopInfo &LI,
+                    ScalarEvolution &SE, DomTreeUpdater &DTU) {
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Latch = L->getLoopLatch();
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *ExitBlock = L->getExitBlock();
+  PHINode *IV = L->getCanonicalInductionVariable();
+  auto *Inc = cast<Instruction>(IV->getIncomingValueForBlock(Latch));
+
+  BasicBlock *From = AtEnd ? Header : Preheader;
+  BasicBlock *To = AtEnd ? ExitBlock : Header;
+  BasicBlock *Entry = nullptr;
+  for (BasicBlock *Succ : successors(Header)) {
+    if (L->contains(Succ)) {
+      Entry = Succ;
+    }
+  }
 
-  if (!ivL1 || !ivL2) {
-    outs() << "[fuseLoops] - Error: Induction variable not found\n";
-    return false;
+  // Dopo le ultime iterazioni l'induzione vale quanto all'uscita della
+  // copia finale: gli usi fuori dal loop vengono raccolti prima di copiare
+  SmallVector<Use *, 4> ExitUses;
+  for (Use &U : IV->uses()) {
+    if (!L->contains(cast<Instruction>(U.getUser()))) {
+      ExitUses.push_back(&U);
+    }
   }
 
-  ivL2->replaceAllUsesWith(ivL1);
-  ivL2->eraseFromParent();
+  SmallVector<BasicBlock *, 8> Blocks;
+  for (BasicBlock *BB : L->blocks()) {
+    if (BB != Header) {
+      Blocks.push_back(BB);
+    }
+  }
 
-  // Blocco che precede l'ingresso del loop
-  BasicBlock *PreheaderL2 = L2->getLoopPreheader();
+  Value *IVValue = AtEnd ? IV : IV->getIncomingValueForBlock(Preheader);
+  BasicBlock *Pred = From;
+  BasicBlock *PredSucc = To;
+  BasicBlock *FirstEntry = nullptr;
+  SmallVector<BasicBlock *, 16> PeeledBlocks;
+  for (unsigned Iteration = 0; Iteration < Count; ++Iteration) {
+    ValueToValueMapTy VMap;
+    VMap[IV] = IVValue;
+
+    SmallVector<BasicBlock *, 8> NewBlocks;
+    for (BasicBlock *BB : Blocks) {
+      BasicBlock *NewBB =
+          CloneBasicBlock(BB, VMap, ".peel", Header->getParent());
+      NewBB->moveBefore(To);
+      VMap[BB] = NewBB;
+      NewBlocks.push_back(NewBB);
+      if (Loop *Parent = L->getParentLoop()) {
+        Parent->addBasicBlockToLoop(NewBB, LI);
+      }
+    }
+    remapInstructionsInBlocks(NewBlocks, VMap);
+
+    BasicBlock *NewEntry = cast<BasicBlock>(VMap[Entry]);
+    Pred->getTerminator()->replaceSuccessorWith(PredSucc, NewEntry);
+    NewEntry->replacePhiUsesWith(Header, Pred);
+    if (!FirstEntry) {
+      FirstEntry = NewEntry;
+    }
+
+    Pred = cast<BasicBlock>(VMap[Latch]);
+    PredSucc = Header;
+    IVValue = VMap[Inc];
+    append_range(PeeledBlocks, NewBlocks);
+  }
+
+  Pred->getTerminator()->replaceSuccessorWith(Header, To);
+  To->replacePhiUsesWith(From, Pred);
 
+  if (AtEnd) {
+    for (Use *U : ExitUses) {
+      U->set(IVValue);
+    }
+  } else {
+    // Il loop ripartisce da zero e fa Count iterazioni in meno: i suoi usi
+    // dell'induzione, compreso il controllo di uscita, la vedono spostata
+    // di Count. L'induzione resta canonica con un nuovo incremento.
+    Instruction *Shifted = BinaryOperator::CreateAdd(
+        IV, ConstantInt::get(IV->getType(), Count), IV->getName() + ".peeled",
+        Header->getFirstNonPHI());
+
+    // Un confronto stretto o di uguaglianza con un bound invariante viene
+    // spostato sul bound, che resta senza overflow perché il loop esegue
+    // almeno Count iterazioni: SCEV ricava così proprio il trip count del
+    // loop più corto, confrontabile con quello del vicino successivo
+    auto *Cmp = dyn_cast<ICmpInst>(
+        cast<BranchInst>(Header->getTerminator())->getCondition());
+    if (Cmp && Cmp->getOperand(0) == IV &&
+        L->isLoopInvariant(Cmp->getOperand(1)) &&
+        (Cmp->isEquality() || Cmp->getPredicate() == ICmpInst::ICMP_ULT ||
+         Cmp->getPredicate() == ICmpInst::ICMP_SLT)) {
+      IRBuilder<> Builder(Pred->getTerminator());
+      Value *Bound = Cmp->getOperand(1);
+      Cmp->setOperand(
+          1, Builder.CreateSub(Bound, ConstantInt::get(IV->getType(), Count),
+                               Bound->getName() + ".peeled"));
+    } else {
+      Cmp = nullptr;
+    }
+
+    IV->replaceUsesWithIf(Shifted, [&](Use &U) {
+      return U.getUser() != Shifted && U.getUser() != Cmp;
+    });
+    if (Shifted->use_empty()) {
+      Shifted->eraseFromParent();
+    }
+
+    Instruction *NewInc = BinaryOperator::CreateAdd(
+        IV, ConstantInt::get(IV->getType(), 1), IV->getName() + ".next",
+        Latch->getTerminator());
+    NewInc->copyIRFlags(Inc);
+    IV->setIncomingValueForBlock(Latch, NewInc);
+    if (Inc->use_empty()) {
+      Inc->eraseFromParent();
+    }
+  }
+
+  SmallVector<DominatorTree::UpdateType, 16> Updates = {
+      {DominatorTree::Delete, From, To},
+      {DominatorTree::Insert, From, FirstEntry}};
+  for (BasicBlock *BB : PeeledBlocks) {
+    for (BasicBlock *Succ : successors(BB)) {
+      Updates.push_back({DominatorTree::Insert, BB, Succ});
+    }
+  }
+  DTU.applyUpdates(Updates);
+
+  SE.forgetLoop(L);
+  ++NumPeeled;
+}
+
+void fuseLoops(Loop *L1, Loop *L2, LoopInfo &LI, ScalarEvolution &SE,
+               DomTreeUpdater &DTU) {
   // Blocchi che definiscono l'inizio del loop
   BasicBlock *HeaderL1 = L1->getHeader();
   BasicBlock *HeaderL2 = L2->getHeader();
 
+  // Ogni induzione {Start,+,Step} di L2 diventa la ricorrenza con lo stesso
+  // inizio e lo stesso passo su L1, calcolata all'inizio del suo header: i
+  // due loop fanno lo stesso numero di iterazioni, quindi il valore è lo
+  // stesso a ogni iterazione e all'uscita. SCEVExpander riusa l'induzione
+  // canonica di L1, o ne crea una se L1 non ce l'ha.
+  SCEVExpander Expander(SE, HeaderL1->getModule()->getDataLayout(), "fused");
+  SmallVector<pair<PHINode *, Value *>, 4> Inductions;
+  for (PHINode &Phi : HeaderL2->phis()) {
+    auto *AddRec = cast<SCEVAddRecExpr>(SE.getSCEV(&Phi));
+    const SCEV *Rewritten =
+        SE.getAddRecExpr(AddRec->getStart(), AddRec->getStepRecurrence(SE),
+                         L1, SCEV::FlagAnyWrap);
+    Inductions.push_back(
+        {&Phi, Expander.expandCodeFor(Rewritten, Phi.getType(),
+                                      &*HeaderL1->getFirstInsertionPt())});
+  }
+
+  // Le espressioni calcolate per L2 non sono più valide e le sue istruzioni
+  // non sono più invarianti rispetto a L1. Il chiamante invalida L1 quando
+  // ha finito di fonderlo: i suoi trip count e le sue espressioni restano
+  // validi finché la fusione non lo riguarda più.
+  SE.forgetLoop(L2);
+  SE.forgetLoopDispositions();
+
+  for (auto [Phi, Induction] : Inductions) {
+    Phi->replaceAllUsesWith(Induction);
+    Phi->eraseFromParent();
+  }
+
   // Blocchi che formano il body dei loop
   BasicBlock *BodyL2 = getLoopBody(L2, LI);
 
@@ -220,97 +1409,755 @@ bool fuseLoops(Loop *L1, Loop *L2, LoopInfo &LI) {
   BasicBlock *LatchL1 = L1->getLoopLatch();
   BasicBlock *LatchL2 = L2->getLoopLatch();
 
+  BasicBlock *ExitBlockL1 = L1->getExitBlock();
   BasicBlock *ExitBlockL2 = L2->getExitBlock();
 
-  // Sostituisco nel'HeaderL1 il successore PreheaderL2 con l'ExitBlockL2
-  HeaderL1->getTerminator()->replaceSuccessorWith(PreheaderL2, ExitBlockL2);
+  // Archi modificati, applicati ai dominatori alla fine
+  SmallVector<DominatorTree::UpdateType, 8> Updates;
+  auto redirect = [&](BasicBlock *BB, BasicBlock *From, BasicBlock *To) {
+    BB->getTerminator()->replaceSuccessorWith(From, To);
+    Updates.push_back({DominatorTree::Delete, BB, From});
+    Updates.push_back({DominatorTree::Insert, BB, To});
+  };
+
+  // Sostituisco nel'HeaderL1 l'uscita (il PreheaderL2 o un blocco vuoto
+  // che porta al PreheaderL2) con l'ExitBlockL2
+  redirect(HeaderL1, ExitBlockL1, ExitBlockL2);
+
+  // Le phi dell'uscita di L2 ricevono lo stesso valore da HeaderL1: il
+  // valore da HeaderL2 sparisce quando l'header viene cancellato
+  for (PHINode &PN : ExitBlockL2->phis()) {
+    PN.addIncoming(PN.getIncomingValueForBlock(HeaderL2), HeaderL1);
+  }
 
-  // Il body di L2 deve essere agganciato a seguito del body di L1
-  for (auto *LatchL1Pred : predecessors(LatchL1)) {
+  // Il body di L2 deve essere agganciato a seguito del body di L1. I
+  // predecessori vengono copiati perché cambiano durante la modifica.
+  SmallSetVector<BasicBlock *, 4> LatchL1Preds(pred_begin(LatchL1),
+                                               pred_end(LatchL1));
+  for (auto *LatchL1Pred : LatchL1Preds) {
     // LatchL1Pred sono i blocchi del body di L1
-    LatchL1Pred->getTerminator()->replaceSuccessorWith(LatchL1, BodyL2);
+    redirect(LatchL1Pred, LatchL1, BodyL2);
   }
   // Aggancio il body di L2 al latch di L1
-  for (auto *LatchL2Pred : predecessors(LatchL2)) {
+  SmallSetVector<BasicBlock *, 4> LatchL2Preds(pred_begin(LatchL2),
+                                               pred_end(LatchL2));
+  for (auto *LatchL2Pred : LatchL2Preds) {
     // LatchL2Pred sono i blocchi del body di L2
-    LatchL2Pred->getTerminator()->replaceSuccessorWith(LatchL2, LatchL1);
+    redirect(LatchL2Pred, LatchL2, LatchL1);
   }
 
   // Sostituisco nel'HeaderL2 il successore BodyL2 con LatchL2
-  HeaderL2->getTerminator()->replaceSuccessorWith(BodyL2, LatchL2);
+  redirect(HeaderL2, BodyL2, LatchL2);
+
+  DTU.applyUpdates(Updates);
+
+  // Aggiorno il loop L1 per includere tutti i blocchi di L2, tranne
+  // HeaderL2 e LatchL2, e i loop interni di L2. I loop che contengono L1
+  // e L2 contengono già questi blocchi.
+  for (BasicBlock *BB : L2->blocks()) {
+    if (BB == HeaderL2 || BB == LatchL2) {
+      continue;
+    }
 
-  // Aggiorno il loop L1 per includere tutti i blocchi di L2,
-  // tranne HeaderL2 e LatchL2
-  for (auto blocksL2 : L2->blocks()) {
-    if (blocksL2 != HeaderL2 && blocksL2 != LatchL2) {
-      L1->addBasicBlockToLoop(blocksL2, LI);
+    L1->addBlockEntry(BB);
+    if (LI.getLoopFor(BB) == L2) {
+      LI.changeLoopFor(BB, L1);
     }
   }
 
+  while (!L2->isInnermost()) {
+    L1->addChildLoop(L2->removeChildLoop(L2->begin()));
+  }
+
+  // L2 non esiste più: i suoi blocchi rimasti vengono cancellati e il loop
+  // viene staccato dal padre o dai loop top-level
+  LI.removeBlock(HeaderL2);
+  LI.removeBlock(LatchL2);
+  if (Loop *Parent = L2->getParentLoop()) {
+    Parent->removeChildLoop(L2);
+  } else {
+    LI.removeLoop(find(LI, L2));
+  }
+
+  deleteUnreachableBlocks({ExitBlockL1, HeaderL2, LatchL2}, L1, ExitBlockL2, LI,
+                          DTU);
+}
+
+// Controlli di un candidato con il suo vicino che usano SCEV e i
+// dominatori: vengono calcolati una volta sola per gruppo
+struct NeighbourChecks {
+  bool SameTripCounts = false;
+  // Iterazioni da staccare se i trip count differiscono di una costante
+  int64_t PeelCount = 0;
+  bool ControlFlowEquivalent = false;
+};
+
+void computeTripCountChecks(NeighbourChecks &Checks, Loop *L1, Loop *L2,
+                            ScalarEvolution &SE) {
+  Checks.SameTripCounts = areLoopNestsEquivalent(L1, L2, SE);
+  Checks.PeelCount = Checks.SameTripCounts ? 0 : getPeelCount(L1, L2, SE);
+}
+
+// Controlla e, se possibile, fonde L2 in L1. Le copie di un loop create
+// dall'unroll-and-jam vengono fuse senza il modello di costo.
+bool tryFuseLoopPair(Loop *L1, Loop *L2, const NeighbourChecks &Checks,
+                     LoopInfo &LI, DomTreeUpdater &DTU, ScalarEvolution &SE,
+                     DependenceInfo &DI, DependenceCache &Cache,
+                     AAResults &AA, const TargetTransformInfo &TTI,
+                     OptimizationRemarkEmitter &ORE, bool UseCostModel) {
+  // Il codice tra due loop non adiacenti viene spostato solo se la
+  // fusione avviene
+  InterveningCode Code;
+  if (!areLoopAdjacent(L1, L2) &&
+      !getInterveningCode(L1, L2, Cache, AA, Code)) {
+    ++NumNotAdjacent;
+    reportNotFused(ORE, L1, L2, "NotAdjacent",
+                   Code.Blocks.empty()
+                       ? "loops are not adjacent"
+                       : "code between the loops cannot be moved");
+    return false;
+  }
+
+  // Loops iterate the same number of times (at every level of the nest),
+  // or do so after peeling a few iterations off the longer one
+  if (!Checks.SameTripCounts && !Checks.PeelCount) {
+    ++NumTripCountDiffer;
+    reportNotFused(ORE, L1, L2, "TripCountsDiffer", "trip counts differ");
+    return false;
+  }
+
+  if (!Checks.ControlFlowEquivalent) {
+    ++NumNotControlFlowEquivalent;
+    reportNotFused(ORE, L1, L2, "NotControlFlowEquivalent",
+                   "loops are not control flow equivalent");
+    return false;
+  }
+
+  if (areLoopDistanceNegative(L1, L2, Checks.PeelCount, DI, SE, Cache)) {
+    ++NumNegativeDistance;
+    reportNotFused(ORE, L1, L2, "NegativeDistance",
+                   "negative distance dependence");
+    return false;
+  }
+
+  // L'header di L2 viene eliminato: può definire solo induzioni, che
+  // vengono ricalcolate in L1. Il remark va emesso prima della fusione,
+  // che cancella L2.
+  if (!isHeaderOnlyControl(L2) || !areInductionsAffine(L2, L1, SE)) {
+    ++NumHeaderPhis;
+    reportNotFused(ORE, L1, L2, "HeaderPhis",
+                   "second header defines values other than affine "
+                   "induction variables");
+    return false;
+  }
+
+  // La fusione è legale: il modello di costo decide se conviene
+  FusionScore Score;
+  if (UseCostModel) {
+    Score = getFusionScore(L1, L2, getMemoryAccesses(L1, Cache),
+                           getMemoryAccesses(L2, Cache), SE, TTI);
+    if (Score.total() <= 0) {
+      ++NumUnprofitable;
+      LLVM_DEBUG(dbgs() << "LoopFusionPass: " << L1->getName() << " and "
+                        << L2->getName() << " not fused: score "
+                        << Score.total() << "\n");
+      ORE.emit([&]() {
+        OptimizationRemarkMissed Remark(DEBUG_TYPE, "Unprofitable",
+                                        L1->getStartLoc(), L1->getHeader());
+        Remark << "loop not fused with " << ore::NV("Loop", L2->getName())
+               << ": fusion not profitable";
+        appendScore(Remark, Score);
+        return Remark;
+      });
+      return false;
+    }
+  }
+
+  ORE.emit([&]() {
+    OptimizationRemark Remark(DEBUG_TYPE, "Fused", L1->getStartLoc(),
+                              L1->getHeader());
+    Remark << (L1->isInnermost() ? "loop" : "loop nest") << " fused with "
+           << ore::NV("Loop", L2->getName());
+    StringRef Sep = " after ";
+    if (Code.size()) {
+      Remark << " after moving " << ore::NV("Moved", Code.size())
+             << " instructions from between the loops";
+      Sep = " and ";
+    }
+    if (Checks.PeelCount) {
+      Remark << Sep << "peeling "
+             << ore::NV("PeelCount", abs(Checks.PeelCount))
+             << (Checks.PeelCount > 0 ? " leading iterations of the first loop"
+                                      : " trailing iterations of the second "
+                                        "loop");
+    }
+    if (UseCostModel) {
+      appendScore(Remark, Score);
+    }
+    return Remark;
+  });
+
+  if (!Code.Blocks.empty()) {
+    moveInterveningCode(L1, L2, Code, SE);
+    NumCodeMoved += Code.size();
+  }
+
+  // Le prime iterazioni di L1 vengono eseguite prima del loop fuso, le
+  // ultime di L2 dopo: l'ordine tra i due loop non cambia. Le copie sono
+  // fuori da entrambi i loop e gli accessi di L1 restano in cache, ma le
+  // coppie che lo contengono vanno ricontrollate con l'induzione spostata.
+  if (Checks.PeelCount > 0) {
+    peelIterations(L1, Checks.PeelCount, false, LI, SE, DTU);
+    Cache.forgetPairs(L1);
+  } else if (Checks.PeelCount < 0) {
+    peelIterations(L2, -Checks.PeelCount, true, LI, SE, DTU);
+  }
+
+  Cache.fuse(L1, L2);
+
+  bool isNest = !L1->isInnermost();
+  fuseLoops(L1, L2, LI, SE, DTU);
+
+  LLVM_DEBUG(dbgs() << "LoopFusionPass: fused " << L1->getName() << "\n");
+  ++NumFused;
+  if (isNest) {
+    ++NumNestsFused;
+  }
+
   return true;
 }
 
-bool tryFuseLoops(list<Loop *> MergeableLoops, LoopInfo &LI, DominatorTree &DT,
-                  PostDominatorTree &PDT, ScalarEvolution &SE,
-                  DependenceInfo &DI) {
+// I candidati sono in ordine di programma e solo due vicini possono essere
+// adiacenti: dopo una fusione L1 viene riprovato con il suo nuovo vicino,
+// altrimenti si passa alla coppia successiva.
+//
+// Avere gli stessi trip count e lo stesso control flow sono relazioni di
+// equivalenza che la fusione conserva: vengono calcolate sullo stato
+// iniziale del gruppo e, dopo aver fuso L2 in L1, L1 eredita i risultati
+// di L2 con il nuovo vicino. Così durante le fusioni del gruppo non servono
+// né i dominatori, aggiornati in modo lazy, né i trip count di L1, che
+// viene invalidato in SCEV una volta sola quando smette di crescere. Il
+// peeling fa eccezione: una differenza costante tra i trip count non è
+// un'equivalenza, e dopo la fusione viene ricalcolata.
+bool tryFuseLoops(list<Loop *> &MergeableLoops, LoopInfo &LI,
+                  DomTreeUpdater &DTU, ScalarEvolution &SE, DependenceInfo &DI,
+                  DependenceCache &Cache, AAResults &AA,
+                  const TargetTransformInfo &TTI,
+                  OptimizationRemarkEmitter &ORE,
+                  SmallSetVector<Loop *, 8> &FusedLoops, bool UseCostModel) {
   bool hasChanged = false;
 
-  for (auto itLoop1 = MergeableLoops.begin(); itLoop1 != MergeableLoops.end();
-       ++itLoop1) {
-    auto itLoop2 = itLoop1;
-    ++itLoop2; // itLoop2 parte dall'elemento successivo a itLoop1
+  DominatorTree &DT = DTU.getDomTree();
+  PostDominatorTree &PDT = DTU.getPostDomTree();
+  DenseMap<Loop *, NeighbourChecks> ChecksWithNext;
+  for (auto It = MergeableLoops.begin(); next(It) != MergeableLoops.end();
+       ++It) {
+    Loop *Next = *next(It);
+    computeTripCountChecks(ChecksWithNext[*It], *It, Next, SE);
+    ChecksWithNext[*It].ControlFlowEquivalent =
+        areLoopsControlFlowEquivalent(*It, Next, DT, PDT);
+  }
 
-    for (; itLoop2 != MergeableLoops.end(); ++itLoop2) {
+  auto itLoop1 = MergeableLoops.begin();
+  bool isL1Fused = false;
+  while (itLoop1 != MergeableLoops.end()) {
+    Loop *L1 = *itLoop1;
+    auto itLoop2 = next(itLoop1);
+
+    if (itLoop2 != MergeableLoops.end() &&
+        tryFuseLoopPair(L1, *itLoop2, ChecksWithNext[L1], LI, DTU, SE, DI,
+                        Cache, AA, TTI, ORE, UseCostModel)) {
+      bool Peeled = ChecksWithNext[L1].PeelCount != 0;
+      ChecksWithNext[L1] = ChecksWithNext.lookup(*itLoop2);
+      MergeableLoops.erase(itLoop2);
+      FusedLoops.insert(L1);
+      isL1Fused = hasChanged = true;
+
+      // Il peeling cambia il trip count di L1 o richiede di staccare
+      // iterazioni dal loop fuso: i trip count con il nuovo vicino vengono
+      // ricalcolati, con i dominatori aggiornati che SCEV usa per le guardie
+      auto itNext = next(itLoop1);
+      if (itNext != MergeableLoops.end() &&
+          (Peeled || ChecksWithNext[L1].PeelCount)) {
+        DTU.flush();
+        SE.forgetLoop(L1);
+        computeTripCountChecks(ChecksWithNext[L1], L1, *itNext, SE);
+      }
+      continue;
+    }
 
-      Loop *L1 = *itLoop1;
-      Loop *L2 = *itLoop2;
+    if (isL1Fused) {
+      SE.forgetLoop(L1);
+      isL1Fused = false;
+    }
+    ++itLoop1;
+  }
 
-      outs() << "[TRYFUSE] Checking if loops can be fused\n";
-      L1->print(outs());
-      outs() << "\n";
-      L2->print(outs());
-      outs() << "\n";
+  return hasChanged;
+}
 
-      if (!areLoopAdjacent(L1, L2)) {
-        outs() << "[TRYFUSE] - Loops are not adjacent\n";
-        continue;
+// Istruzioni che possono essere eseguite tra Def e Load nella stessa
+// iterazione di L: i blocchi raggiungibili da Def e che raggiungono Load
+// senza passare dall'header. Def è uno store o un load che domina Load.
+bool isClobberedInIteration(Instruction *Def, LoadInst *Load, Loop *L,
+                            AAResults &AA) {
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *DefBB = Def->getParent();
+  BasicBlock *LoadBB = Load->getParent();
+
+  SmallPtrSet<BasicBlock *, 8> Forward;
+  SmallVector<BasicBlock *, 8> Worklist = {DefBB};
+  while (!Worklist.empty()) {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (!Forward.insert(BB).second || BB == LoadBB) {
+      continue;
+    }
+    for (BasicBlock *Succ : successors(BB)) {
+      if (Succ != Header && L->contains(Succ)) {
+        Worklist.push_back(Succ);
       }
-      outs() << "[TRYFUSE] + Loops are adjacent\n";
+    }
+  }
 
-      // Loops iterate the same number of times
-      if (!areLoopTripCountEquivalent(L1, L2, SE)) {
-        outs() << "[TRYFUSE] - Loops do not iterate the same number of times\n";
-        continue;
+  SmallSetVector<BasicBlock *, 8> Between;
+  Worklist = {LoadBB};
+  while (!Worklist.empty()) {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (!Forward.count(BB) || !Between.insert(BB) || BB == DefBB) {
+      continue;
+    }
+    append_range(Worklist, predecessors(BB));
+  }
+
+  MemoryLocation Loc = MemoryLocation::get(Load);
+  for (BasicBlock *BB : Between) {
+    auto Begin = BB == DefBB ? next(Def->getIterator()) : BB->begin();
+    auto End = BB == LoadBB ? Load->getIterator() : BB->end();
+    for (Instruction &I : make_range(Begin, End)) {
+      if (I.mayWriteToMemory() && isModSet(AA.getModRefInfo(&I, Loc))) {
+        return true;
       }
-      outs() << "[TRYFUSE] + Loops iterate the same number of times\n";
+    }
+  }
 
-      if (!areLoopsControlFlowEquivalent(L1, L2, DT, PDT)) {
-        outs() << "[TRYFUSE] Loops are not control flow equivalent\n";
-        continue;
+  return false;
+}
+
+// Dopo la fusione il valore scritto dal corpo di L1 e letto dal corpo di
+// L2 nella stessa iterazione passa ancora dalla memoria: ogni load del
+// loop fuso prende il valore dell'ultimo store o load allo stesso
+// indirizzo che lo domina, se nessuna istruzione in mezzo può modificarlo.
+// Così anche i dati letti da più corpi, come quelli delle copie fuse
+// dall'unroll-and-jam, vengono caricati una volta sola. Gli accessi dei
+// loop interni restano in memoria. Restituisce il numero di load eliminati
+// e in Objects gli oggetti letti dai load che prendono il valore di uno
+// store.
+unsigned forwardStoredValues(Loop *L, LoopInfo &LI, DominatorTree &DT,
+                             ScalarEvolution &SE, AAResults &AA,
+                             SmallSetVector<Value *, 4> &Objects) {
+  SmallVector<Instruction *, 8> Defs;
+  SmallVector<LoadInst *, 8> Loads;
+  for (BasicBlock *BB : L->blocks()) {
+    if (LI.getLoopFor(BB) != L) {
+      continue;
+    }
+    for (Instruction &I : *BB) {
+      if (auto *Store = dyn_cast<StoreInst>(&I); Store && Store->isSimple()) {
+        Defs.push_back(Store);
+      } else if (auto *Load = dyn_cast<LoadInst>(&I);
+                 Load && Load->isSimple()) {
+        Defs.push_back(Load);
+        Loads.push_back(Load);
       }
-      outs() << "[TRYFUSE] + Loops are control flow equivalent\n";
+    }
+  }
 
-      if (areLoopDistanceNegative(L1, L2, DI)) {
-        outs() << "[TRYFUSE] - Loops have negative distance dependencies\n";
+  unsigned NumForwarded = 0;
+  for (LoadInst *Load : Loads) {
+    const SCEV *Address = SE.getSCEV(Load->getPointerOperand());
+
+    // L'accesso più vicino è dominato da tutti gli altri candidati
+    Instruction *Closest = nullptr;
+    for (Instruction *Def : Defs) {
+      if (Def == Load || getLoadStoreType(Def) != Load->getType() ||
+          !DT.dominates(Def, Load) ||
+          !SE.getMinusSCEV(SE.getSCEV(getLoadStorePointerOperand(Def)),
+                           Address)
+               ->isZero()) {
         continue;
       }
-      outs()
-          << "[TRYFUSE] + Loops do not have negative distance dependencies\n";
+      if (!Closest || DT.dominates(Closest, Def)) {
+        Closest = Def;
+      }
+    }
+
+    if (!Closest || isClobberedInIteration(Closest, Load, L, AA)) {
+      continue;
+    }
 
-      bool isFused = fuseLoops(L1, L2, LI);
+    LLVM_DEBUG(dbgs() << "LoopFusionPass: forwarding " << *Closest << " to "
+                      << *Load << "\n");
+    Value *Ptr = Load->getPointerOperand();
+    Value *Forwarded = Closest;
+    if (auto *Store = dyn_cast<StoreInst>(Closest)) {
+      Objects.insert(getUnderlyingObject(Ptr));
+      Forwarded = Store->getValueOperand();
+    }
+    SE.forgetValue(Load);
+    Load->replaceAllUsesWith(Forwarded);
+    Defs.erase(find(Defs, Load));
+    Load->eraseFromParent();
+
+    // L'indirizzo calcolato solo per il load non serve più
+    if (auto *GEP = dyn_cast<GetElementPtrInst>(Ptr); GEP && GEP->use_empty()) {
+      SE.forgetValue(GEP);
+      GEP->eraseFromParent();
+    }
+    ++NumForwarded;
+  }
 
-      outs() << "[TRYFUSE] " << (isFused ? "Loops fused" : "Loops not fused")
-             << "\n";
-      outs() << "-----------------------------------\n";
+  NumLoadsForwarded += NumForwarded;
+  return NumForwarded;
+}
 
-      if (isFused) {
-        LI.erase(L2);
-        hasChanged = true;
+// Un array locale che dopo l'inoltro non viene più letto, né passato ad
+// altre istruzioni, contiene solo valori che nessuno usa: i suoi store,
+// gli indirizzi calcolati e l'alloca vengono cancellati.
+bool removeWriteOnlyArray(AllocaInst *Array, ScalarEvolution &SE) {
+  SmallSetVector<Instruction *, 16> Dead;
+  Dead.insert(Array);
+  for (unsigned Idx = 0; Idx < Dead.size(); ++Idx) {
+    for (Use &U : Dead[Idx]->uses()) {
+      auto *User = cast<Instruction>(U.getUser());
+      if (isa<GetElementPtrInst>(User) || isa<BitCastInst>(User) ||
+          User->isLifetimeStartOrEnd() ||
+          (isa<StoreInst>(User) && cast<StoreInst>(User)->isSimple() &&
+           U.getOperandNo() == StoreInst::getPointerOperandIndex())) {
+        Dead.insert(User);
+      } else {
+        return false;
       }
     }
   }
 
-  return hasChanged;
+  // Gli utenti vengono trovati dopo le istruzioni che usano
+  for (Instruction *I : reverse(Dead)) {
+    SE.forgetValue(I);
+    I->eraseFromParent();
+  }
+  return true;
+}
+
+// Remark "missed" per un nido candidato all'unroll-and-jam, con il motivo
+void reportNotUnrolledAndJammed(OptimizationRemarkEmitter &ORE, Loop *L,
+                                StringRef RemarkName, StringRef Reason) {
+  ++NumNotUnrolledAndJammed;
+  LLVM_DEBUG(dbgs() << "LoopFusionPass: " << L->getName()
+                    << " not unrolled and jammed: " << Reason << "\n");
+  ORE.emit([&]() {
+    return OptimizationRemarkMissed(DEBUG_TYPE, RemarkName, L->getStartLoc(),
+                                    L->getHeader())
+           << "loop nest not unrolled and jammed: " << Reason;
+  });
+}
+
+// Dopo l'unroll-and-jam, all'iterazione k del loop interno, la copia
+// eseguita Shift iterazioni dopo del loop esterno non deve toccare memoria
+// che la copia precedente tocca a un'iterazione successiva: è lo stesso
+// controllo della fusione delle copie, fatto prima di crearle confrontando
+// gli accessi del loop interno con se stessi spostati sul loop esterno
+bool hasJamNegativeDistance(Loop *Outer, Loop *Inner, unsigned Factor,
+                            DependenceInfo &DI, ScalarEvolution &SE) {
+  LoopMemoryAccesses Accesses;
+  collectMemoryAccesses(Inner, Accesses);
+
+  DenseMap<const Loop *, const Loop *> LoopMap;
+  AddRecLoopReplacer Replacer(SE, LoopMap);
+  for (unsigned Shift = 1; Shift < Factor; ++Shift) {
+    FusedIterationSpace Space = {Inner, 0, SE, Replacer, Outer, Shift};
+    if (hasNegativeDistance(Accesses, Accesses, DI, Space)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Un nido a due livelli si può srotolare di Factor e fondere se:
+//   - il loop esterno ha l'induzione canonica come unica phi e confronta
+//     con slt, ult o ne un bound invariante, restando nel loop se vero
+//   - il suo corpo, fuori dal loop interno, è una linea retta di calcoli
+//     senza effetti collaterali né accessi in memoria: nelle copie diventa
+//     codice tra due loop interni che la fusione sposta
+//   - nessun valore del nido è usato fuori dal loop che lo definisce
+//   - il loop interno ha la struttura richiesta dalla fusione, solo
+//     induzioni nell'header e un trip count invariante nel loop esterno
+//   - le copie del loop interno non hanno dipendenze a distanza negativa
+bool canUnrollAndJam(Loop *Outer, unsigned Factor, LoopInfo &LI,
+                     ScalarEvolution &SE, DependenceInfo &DI,
+                     OptimizationRemarkEmitter &ORE) {
+  Loop *Inner = Outer->getSubLoops().front();
+  BasicBlock *Header = Outer->getHeader();
+  PHINode *IV = Outer->getCanonicalInductionVariable();
+  auto *Br = dyn_cast<BranchInst>(Header->getTerminator());
+  auto *Cmp = Br && Br->isConditional()
+                  ? dyn_cast<ICmpInst>(Br->getCondition())
+                  : nullptr;
+  if (!hasFusionShape(Outer) || !IV || !Cmp || !Cmp->hasOneUse() ||
+      Cmp->getOperand(0) != IV ||
+      !Outer->isLoopInvariant(Cmp->getOperand(1)) ||
+      !Outer->contains(Br->getSuccessor(0)) ||
+      (Cmp->getPredicate() != ICmpInst::ICMP_SLT &&
+       Cmp->getPredicate() != ICmpInst::ICMP_ULT &&
+       Cmp->getPredicate() != ICmpInst::ICMP_NE)) {
+    reportNotUnrolledAndJammed(ORE, Outer, "NotCanonical",
+                               "outer loop has no canonical induction "
+                               "variable compared with an invariant bound");
+    return false;
+  }
+
+  unsigned TripCount = SE.getSmallConstantTripCount(Outer);
+  if (TripCount && TripCount < Factor) {
+    reportNotUnrolledAndJammed(ORE, Outer, "TripCountTooSmall",
+                               "outer trip count is smaller than the "
+                               "unroll factor");
+    return false;
+  }
+
+  for (BasicBlock *BB : Outer->blocks()) {
+    Loop *Defining = LI.getLoopFor(BB);
+    bool isBody = Defining == Outer && BB != Header &&
+                  BB != Outer->getLoopLatch();
+    if (isBody && (!BB->getSinglePredecessor() || !BB->getSingleSuccessor())) {
+      reportNotUnrolledAndJammed(ORE, Outer, "NotStraightLine",
+                                 "outer loop body is not a straight line "
+                                 "around the inner loop");
+      return false;
+    }
+
+    for (Instruction &I : *BB) {
+      bool isOuterCode = Defining == Outer && &I != IV && !I.isTerminator();
+      if ((isOuterCode &&
+           (isa<PHINode>(I) || I.mayHaveSideEffects() ||
+            I.mayReadFromMemory())) ||
+          any_of(I.users(), [&](User *U) {
+            return !Defining->contains(cast<Instruction>(U));
+          })) {
+        reportNotUnrolledAndJammed(ORE, Outer, "OuterCode",
+                                   "outer loop body has side effects or "
+                                   "values used outside their loop");
+        return false;
+      }
+    }
+  }
+
+  const SCEV *InnerCount = SE.getBackedgeTakenCount(Inner);
+  if (!hasFusionShape(Inner) || !isHeaderOnlyControl(Inner) ||
+      !areInductionsAffine(Inner, Inner, SE) ||
+      isa<SCEVCouldNotCompute>(InnerCount) ||
+      !SE.isLoopInvariant(InnerCount, Outer)) {
+    reportNotUnrolledAndJammed(ORE, Outer, "InnerNotFusable",
+                               "inner loop copies cannot be fused");
+    return false;
+  }
+
+  if (hasJamNegativeDistance(Outer, Inner, Factor, DI, SE)) {
+    reportNotUnrolledAndJammed(ORE, Outer, "NegativeDistance",
+                               "negative distance dependence between "
+                               "copies of the inner loop");
+    return false;
+  }
+
+  return true;
+}
+
+// Crea in LoopInfo la copia di L e dei suoi loop interni sotto Parent, o
+// tra i loop top-level se Parent è nullo. I blocchi copiati sono in VMap.
+Loop *cloneLoopTree(Loop *L, Loop *Parent, ValueToValueMapTy &VMap,
+                    LoopInfo &LI) {
+  Loop *New = LI.AllocateLoop();
+  if (Parent) {
+    Parent->addChildLoop(New);
+  } else {
+    LI.addTopLevelLoop(New);
+  }
+
+  // L'header è il primo blocco di L
+  for (BasicBlock *BB : L->blocks()) {
+    if (LI.getLoopFor(BB) == L) {
+      New->addBasicBlockToLoop(cast<BasicBlock>(VMap[BB]), LI);
+    }
+  }
+  for (Loop *Sub : *L) {
+    cloneLoopTree(Sub, New, VMap, LI);
+  }
+
+  return New;
+}
+
+// Srotola Outer di Factor. Le iterazioni rimaste quando ne mancano meno di
+// Factor vengono eseguite da una copia del nido dopo il loop: il suo
+// preheader riceve l'induzione all'uscita. Nel loop, dopo il corpo, ci
+// sono Factor - 1 copie del corpo con l'induzione spostata di 1, 2, ...,
+// e l'induzione avanza di Factor. Il loop continua finché restano almeno
+// Factor iterazioni: N - i non va in overflow perché i resta tra 0 e N.
+void unrollOuterLoop(Loop *Outer, unsigned Factor, LoopInfo &LI,
+                     ScalarEvolution &SE, DomTreeUpdater &DTU) {
+  BasicBlock *Header = Outer->getHeader();
+  BasicBlock *Latch = Outer->getLoopLatch();
+  BasicBlock *Preheader = Outer->getLoopPreheader();
+  BasicBlock *ExitBlock = Outer->getExitBlock();
+  Loop *Inner = Outer->getSubLoops().front();
+  Function *F = Header->getParent();
+  PHINode *IV = Outer->getCanonicalInductionVariable();
+  auto *Inc = cast<Instruction>(IV->getIncomingValueForBlock(Latch));
+  auto *Br = cast<BranchInst>(Header->getTerminator());
+  auto *Cmp = cast<ICmpInst>(Br->getCondition());
+  BasicBlock *Entry = Br->getSuccessor(0);
+
+  SE.forgetLoop(Outer);
+
+  SmallVector<DominatorTree::UpdateType, 32> Updates;
+  SmallVector<BasicBlock *, 32> NewBlocks;
+
+  // Copia del nido per le ultime iterazioni, fatta prima di modificarlo
+  ValueToValueMapTy RemMap;
+  SmallVector<BasicBlock *, 16> RemBlocks;
+  for (BasicBlock *BB : Outer->blocks()) {
+    BasicBlock *NewBB = CloneBasicBlock(BB, RemMap, ".rem", F);
+    NewBB->moveBefore(ExitBlock);
+    RemMap[BB] = NewBB;
+    RemBlocks.push_back(NewBB);
+  }
+  remapInstructionsInBlocks(RemBlocks, RemMap);
+  cloneLoopTree(Outer, Outer->getParentLoop(), RemMap, LI);
+  append_range(NewBlocks, RemBlocks);
+
+  auto *RemHeader = cast<BasicBlock>(RemMap[Header]);
+  BasicBlock *RemPreheader = BasicBlock::Create(
+      F->getContext(), Header->getName() + ".rem.ph", F, RemHeader);
+  PHINode *RemStart = PHINode::Create(IV->getType(), 1,
+                                      IV->getName() + ".rem.start",
+                                      RemPreheader);
+  RemStart->addIncoming(IV, Header);
+  BranchInst::Create(RemHeader, RemPreheader);
+  if (Loop *Parent = Outer->getParentLoop()) {
+    Parent->addBasicBlockToLoop(RemPreheader, LI);
+  }
+
+  auto *RemIV = cast<PHINode>(RemMap[IV]);
+  RemIV->setIncomingValueForBlock(Preheader, RemStart);
+  RemIV->setIncomingBlock(RemIV->getBasicBlockIndex(Preheader),
+                          RemPreheader);
+  ExitBlock->replacePhiUsesWith(Header, RemHeader);
+  Br->setSuccessor(1, RemPreheader);
+  Updates.push_back({DominatorTree::Delete, Header, ExitBlock});
+  Updates.push_back({DominatorTree::Insert, Header, RemPreheader});
+  NewBlocks.push_back(RemPreheader);
+
+  // Copie del corpo: l'ultimo blocco di ogni copia passa alla successiva
+  SmallVector<BasicBlock *, 8> Body;
+  for (BasicBlock *BB : Outer->blocks()) {
+    if (BB != Header && BB != Latch) {
+      Body.push_back(BB);
+    }
+  }
+
+  // Le copie vengono create tutte dal corpo originale e poi collegate
+  BasicBlock *BodyTail = Latch->getSinglePredecessor();
+  SmallVector<pair<BasicBlock *, BasicBlock *>, 4> CopyEntryTails;
+  for (unsigned Shift = 1; Shift < Factor; ++Shift) {
+    ValueToValueMapTy VMap;
+    auto *Shifted = BinaryOperator::CreateAdd(
+        IV, ConstantInt::get(IV->getType(), Shift), IV->getName() + ".jam");
+    Shifted->copyIRFlags(Inc);
+    VMap[IV] = Shifted;
+
+    SmallVector<BasicBlock *, 16> CopyBlocks;
+    for (BasicBlock *BB : Body) {
+      BasicBlock *NewBB = CloneBasicBlock(BB, VMap, ".jam", F);
+      NewBB->moveBefore(Latch);
+      VMap[BB] = NewBB;
+      CopyBlocks.push_back(NewBB);
+      if (LI.getLoopFor(BB) == Outer) {
+        Outer->addBasicBlockToLoop(NewBB, LI);
+      }
+    }
+    remapInstructionsInBlocks(CopyBlocks, VMap);
+    cloneLoopTree(Inner, Outer, VMap, LI);
+    append_range(NewBlocks, CopyBlocks);
+
+    auto *CopyEntry = cast<BasicBlock>(VMap[Entry]);
+    Shifted->insertBefore(&*CopyEntry->getFirstInsertionPt());
+    if (Shifted->use_empty()) {
+      Shifted->eraseFromParent();
+    }
+    CopyEntryTails.push_back({CopyEntry, cast<BasicBlock>(VMap[BodyTail])});
+  }
+
+  BasicBlock *Tail = BodyTail;
+  for (auto [CopyEntry, CopyTail] : CopyEntryTails) {
+    Tail->getTerminator()->replaceSuccessorWith(Latch, CopyEntry);
+    Tail = CopyTail;
+  }
+  Updates.push_back({DominatorTree::Delete, BodyTail, Latch});
+  Updates.push_back(
+      {DominatorTree::Insert, BodyTail, CopyEntryTails.front().first});
+
+  for (BasicBlock *BB : NewBlocks) {
+    for (BasicBlock *Succ : successors(BB)) {
+      Updates.push_back({DominatorTree::Insert, BB, Succ});
+    }
+  }
+  DTU.applyUpdates(Updates);
+
+  IRBuilder<> Builder(Br);
+  Value *Remaining = Builder.CreateSub(Cmp->getOperand(1), IV,
+                                       IV->getName() + ".remaining");
+  Value *Cond = Builder.CreateICmp(
+      Cmp->isSigned() ? ICmpInst::ICMP_SGT : ICmpInst::ICMP_UGT, Remaining,
+      ConstantInt::get(IV->getType(), Factor - 1));
+  Cond->takeName(Cmp);
+  Br->setCondition(Cond);
+  Cmp->eraseFromParent();
+  Inc->setOperand(1, ConstantInt::get(IV->getType(), Factor));
+}
+
+// Unroll-and-jam: srotola il loop esterno di un nido a due livelli e fonde
+// le copie del loop interno, che così riusano nei registri i dati letti
+// dalle iterazioni vicine del loop esterno. La legalità viene controllata
+// prima di srotolare; le copie vengono poi fuse con gli stessi controlli
+// della fusione, senza modello di costo.
+bool tryUnrollAndJam(Loop *Outer, unsigned Factor, LoopInfo &LI,
+                     DomTreeUpdater &DTU, ScalarEvolution &SE,
+                     DependenceInfo &DI, AAResults &AA,
+                     const TargetTransformInfo &TTI,
+                     OptimizationRemarkEmitter &ORE,
+                     SmallSetVector<Loop *, 8> &FusedLoops) {
+  if (!canUnrollAndJam(Outer, Factor, LI, SE, DI, ORE)) {
+    return false;
+  }
+
+  unrollOuterLoop(Outer, Factor, LI, SE, DTU);
+
+  list<Loop *> Copies(Outer->begin(), Outer->end());
+  DependenceCache Cache;
+  tryFuseLoops(Copies, LI, DTU, SE, DI, Cache, AA, TTI, ORE, FusedLoops,
+               false);
+  SE.forgetLoop(Outer);
+
+  ++NumUnrolledAndJammed;
+  LLVM_DEBUG(dbgs() << "LoopFusionPass: unrolled " << Outer->getName()
+                    << " by " << Factor << "\n");
+  ORE.emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "UnrolledAndJammed",
+                              Outer->getStartLoc(), Outer->getHeader())
+           << "outer loop unrolled by " << ore::NV("Factor", Factor)
+           << " and inner loop copies jammed into "
+           << ore::NV("InnerLoops", static_cast<unsigned>(Copies.size()))
+           << (Copies.size() == 1 ? " loop" : " loops");
+  });
+  return true;
 }
 
 // In order for two loops, Lj and Lk to be fused, they must satisfy
@@ -318,7 +2165,9 @@ bool tryFuseLoops(list<Loop *> MergeableLoops, LoopInfo &LI, DominatorTree &DT,
 //   1. Lj and Lk must be adjacent
 //     • There cannot be any statements that execute between the end of Lj and
 //       the beginning of Lk
+//     • Or they can be moved before Lj or after Lk
 //   2. Lj and Lk must iterate the same number of times
+//     • Or differ by a few iterations, peeled off the longer loop
 //   3. Lj and Lk must be control flow equivalent
 //     • When Lj executes Lk also executes or when Lk executes Lj also executes
 //   4. There cannot be any negative distance dependencies
@@ -328,38 +2177,126 @@ bool tryFuseLoops(list<Loop *> MergeableLoops, LoopInfo &LI, DominatorTree &DT,
 //       future iteration m+n (where n > 0).
 PreservedAnalyses LoopFusionPass::run(Function &F,
                                       FunctionAnalysisManager &AM) {
-  outs() << "Running LoopFusionPass on " << F.getName() << "\n";
+  LLVM_DEBUG(dbgs() << "LoopFusionPass: running on " << F.getName() << "\n");
 
   LoopInfo &LI = AM.getResult<LoopAnalysis>(F);
   DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
   PostDominatorTree &PDT = AM.getResult<PostDominatorTreeAnalysis>(F);
   ScalarEvolution &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
   DependenceInfo &DI = AM.getResult<DependenceAnalysis>(F);
+  AAResults &AA = AM.getResult<AAManager>(F);
+  TargetTransformInfo &TTI = AM.getResult<TargetIRAnalysis>(F);
+  OptimizationRemarkEmitter &ORE =
+      AM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+
+  // Gli aggiornamenti dei dominatori vengono accumulati e applicati quando
+  // servono: una volta per gruppo di fratelli e alla fine
+  DomTreeUpdater DTU(DT, PDT, DomTreeUpdater::UpdateStrategy::Lazy);
+
+  // I risultati del controllo delle dipendenze restano validi tra un
+  // gruppo e l'altro: solo le coppie toccate da una fusione vengono
+  // ricalcolate
+  DependenceCache Cache;
+
+  // Genitori dei gruppi di fratelli da visitare, nullptr per i loop
+  // top-level. I figli di un loop entrano nella worklist dopo che il loop
+  // è stato fuso con i suoi vicini: i loop interni dei nidi fusi sono già
+  // fratelli quando il loro gruppo viene visitato.
+  SmallVector<Loop *, 8> Worklist = {nullptr};
+
+  // Loop che hanno assorbito un vicino: la fusione non cancella mai un
+  // loop che ne ha già assorbito un altro
+  SmallSetVector<Loop *, 8> FusedLoops;
 
   bool Transformed = false;
-  do {
-    list<Loop *> MergeableLoops = getMergeableLoops(&LI);
-    if (MergeableLoops.size() < 2) {
-      outs() << "No mergeable loops found\n";
-      break;
+  while (!Worklist.empty()) {
+    Loop *Parent = Worklist.pop_back_val();
+
+    list<Loop *> MergeableLoops =
+        getMergeableSiblings(getSiblingLoops(Parent, LI), ORE);
+    if (MergeableLoops.size() >= 2 &&
+        tryFuseLoops(MergeableLoops, LI, DTU, SE, DI, Cache, AA, TTI, ORE,
+                     FusedLoops, CostModel)) {
+      Transformed = true;
     }
 
-    Transformed = tryFuseLoops(MergeableLoops, LI, DT, PDT, SE, DI);
-    if (Transformed) {
-      outs() << "[RUN] Loops fused\n";
-      Transformed = false;
-    } else {
-      outs() << "[RUN] No loops fused\n";
+    // In ordine inverso, così i gruppi vengono visitati in ordine di
+    // programma
+    SmallVector<Loop *, 8> Siblings = getSiblingLoops(Parent, LI);
+    for (Loop *L : reverse(Siblings)) {
+      if (L->getSubLoops().size() >= 2) {
+        Worklist.push_back(L);
+      }
     }
-  } while (Transformed);
+  }
+
+  // I nidi a due livelli rimasti vengono srotolati e le copie dei loop
+  // interni fuse: i candidati vengono scelti prima di creare le copie
+  if (UnrollAndJamFactor > 1) {
+    SmallVector<Loop *, 4> Nests;
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      if (L->getSubLoops().size() == 1 && L->getSubLoops()[0]->isInnermost()) {
+        Nests.push_back(L);
+      }
+    }
+
+    for (Loop *Outer : Nests) {
+      DTU.flush();
+      Transformed |= tryUnrollAndJam(Outer, UnrollAndJamFactor, LI, DTU, SE,
+                                     DI, AA, TTI, ORE, FusedLoops);
+    }
+  }
 
   // Elimino i blocchi inutilizzati
-  EliminateUnreachableBlocks(F);
+  Transformed |= EliminateUnreachableBlocks(F, &DTU);
+  DTU.flush();
+
+  // Con i dominatori aggiornati, i valori passati tra i corpi dei loop fusi
+  // restano nei registri e gli array temporanei non più letti spariscono
+  for (Loop *L : FusedLoops) {
+    SmallSetVector<Value *, 4> Objects;
+    unsigned NumForwarded = forwardStoredValues(L, LI, DT, SE, AA, Objects);
+    if (!NumForwarded) {
+      continue;
+    }
+
+    SmallVector<string, 4> Removed;
+    for (Value *Object : Objects) {
+      auto *Array = dyn_cast<AllocaInst>(Object);
+      string Name = Object->getName().str();
+      if (Array && removeWriteOnlyArray(Array, SE)) {
+        Removed.push_back(Name);
+      }
+    }
+    NumArraysRemoved += Removed.size();
+
+    ORE.emit([&]() {
+      OptimizationRemark Remark(DEBUG_TYPE, "Forwarded", L->getStartLoc(),
+                                L->getHeader());
+      Remark << "forwarded " << ore::NV("Forwarded", NumForwarded)
+             << " stored or loaded values to loads in the fused loop";
+      if (!Removed.empty()) {
+        Remark << " and removed " << ore::NV("Arrays", join(Removed, ", "));
+      }
+      return Remark;
+    });
+  }
 
   // Verifico che la funzione sia corretta
   if (verifyFunction(F, &errs())) {
     errs() << "[RUN] Error: Function verification failed after loop fusion\n";
   }
 
-  return Transformed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+  if (!Transformed) {
+    return PreservedAnalyses::all();
+  }
+
+  // LoopInfo e i dominatori sono aggiornati durante la fusione, SCEV
+  // dimentica i loop fusi
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<PostDominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  PA.preserve<ScalarEvolutionAnalysis>();
+  return PA;
 }
\ No newline at end of file
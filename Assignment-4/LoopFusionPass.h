@@ -10,15 +10,7 @@
 #ifndef LLVM_TRANSFORMS_LoopFusionPass_H
 #define LLVM_TRANSFORMS_LoopFusionPass_H
 
-#include "llvm/Analysis/DependenceAnalysis.h"
-#include "llvm/Analysis/LoopAnalysisManager.h"
-#include "llvm/Analysis/LoopInfo.h"
-#include "llvm/Analysis/PostDominators.h"
-#include "llvm/Analysis/ScalarEvolution.h"
-#include "llvm/IR/Dominators.h"
 #include "llvm/IR/PassManager.h"
-#include "llvm/IR/Verifier.h"
-#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
 namespace llvm {
 class LoopFusionPass : public PassInfoMixin<LoopFusionPass> {
@@ -0,0 +1,59 @@
+//===-- LoopFusionUtils.h - Custom Transformations ------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// Path:
+//  SRC/llvm/lib/Transforms/Utils/LoopFusionUtils.h
+//===----------------------------------------------------------------===//
+//
+// Header interno, incluso solo da LoopFusionPass.cpp e LoopTilingPass.cpp:
+// non viene installato con gli header pubblici.
+//
+//===----------------------------------------------------------------===//
+#ifndef LLVM_LIB_TRANSFORMS_UTILS_LoopFusionUtils_H
+#define LLVM_LIB_TRANSFORMS_UTILS_LoopFusionUtils_H
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+
+// Controlli sulla forma dei loop e sugli accessi in memoria, usati anche da
+// LoopTilingPass
+
+// Accessi in memoria di un loop raggruppati per oggetto sottostante: le
+// coppie di accessi a oggetti identificati distinti non vengono chieste a DI
+struct LoopMemoryAccesses {
+  llvm::MapVector<const llvm::Value *,
+                  llvm::SmallVector<llvm::Instruction *, 4>>
+      ByObject;
+  // Oggetti non identificati (argomenti, puntatori caricati, phi), che
+  // possono sovrapporsi a qualsiasi altro oggetto
+  llvm::SmallSetVector<const llvm::Value *, 4> Unidentified;
+  // Chiamate e accessi atomici o volatili, che DI non analizza
+  llvm::SmallVector<llvm::Instruction *, 4> Unknown;
+
+  void add(const llvm::Value *Object, llvm::Instruction *I) {
+    ByObject[Object].push_back(I);
+    if (!llvm::isIdentifiedObject(Object)) {
+      Unidentified.insert(Object);
+    }
+  }
+};
+
+// Preheader, latch, uscita unica dall'header e forma semplificata
+bool hasFusionShape(llvm::Loop *L);
+// Il preheader, o il blocco della guardia se il loop è protetto
+llvm::BasicBlock *getLoopEntry(llvm::Loop *L);
+// L'header definisce solo phi e valori usati al suo interno
+bool isHeaderOnlyControl(llvm::Loop *L);
+void collectMemoryAccesses(llvm::Loop *L, LoopMemoryAccesses &Accesses);
+// Una chiamata o un accesso atomico di Unknown e un accesso di Other, uno
+// dei due scrive
+bool conflictsWithUnknown(llvm::ArrayRef<llvm::Instruction *> Unknown,
+                          const LoopMemoryAccesses &Other);
+
+#endif // LLVM_LIB_TRANSFORMS_UTILS_LoopFusionUtils_H
\ No newline at end of file
@@ -0,0 +1,553 @@
+//===-- LoopTilingPass.cpp - Custom Transformations --------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// Path:
+//  SRC/llvm/lib/Transforms/Utils/LoopTilingPass.cpp
+//===------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/LoopTilingPass.h"
+#include "LoopFusionUtils.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+using namespace llvm;
+using namespace std;
+
+#define DEBUG_TYPE "looptilingpass"
+
+STATISTIC(NumNestsTiled, "Number of loop nests tiled");
+STATISTIC(NumLoopsTiled, "Number of loops split into tiles");
+STATISTIC(NumNotPerfect, "Number of loop nests not perfectly nested");
+STATISTIC(NumNotTileable,
+          "Number of loop nests with dependences that prevent tiling");
+STATISTIC(NumFitInTile,
+          "Number of loop nests whose inner loops already fit in a tile");
+
+static cl::opt<unsigned> CacheSize(
+    "looptilingpass-cache-size", cl::init(0), cl::Hidden,
+    cl::desc("Size in bytes of the cache that the data of a tile must fit "
+             "in (0 uses the L1 data cache of the target, 32 KB if unknown)"));
+
+static cl::opt<unsigned> TileSize(
+    "looptilingpass-tile-size", cl::init(0), cl::Hidden,
+    cl::desc("Iterations of each loop in a tile (0 computes it from the "
+             "cache size)"));
+
+// Un loop del nido: l'induzione canonica e il confronto dell'header con un
+// bound invariante in tutto il nido
+struct NestLevel {
+  Loop *L = nullptr;
+  PHINode *IV = nullptr;
+  ICmpInst *Cmp = nullptr;
+  Value *Bound = nullptr;
+  bool isSigned = false;
+  // Il loop viene diviso in tile
+  bool Tiled = false;
+};
+
+// Remark "missed" per un nido candidato, con il motivo
+void reportNotTiled(OptimizationRemarkEmitter &ORE, Loop *L,
+                    StringRef RemarkName, StringRef Reason) {
+  LLVM_DEBUG(dbgs() << "LoopTilingPass: " << L->getName()
+                    << " not tiled: " << Reason << "\n");
+  ORE.emit([&]() {
+    return OptimizationRemarkMissed(DEBUG_TYPE, RemarkName, L->getStartLoc(),
+                                    L->getHeader())
+           << "loop nest not tiled: " << Reason;
+  });
+}
+
+// Il loop ha la forma richiesta dalla fusione, l'induzione canonica come
+// unica phi dell'header e un'uscita `iv < Bound` (o `iv != Bound`), con
+// Bound e trip count invarianti in Outermost
+bool getNestLevel(Loop *L, Loop *Outermost, ScalarEvolution &SE,
+                  NestLevel &Level) {
+  if (!hasFusionShape(L) || !isHeaderOnlyControl(L)) {
+    return false;
+  }
+
+  PHINode *IV = L->getCanonicalInductionVariable();
+  BasicBlock *Header = L->getHeader();
+  if (!IV ||
+      any_of(Header->phis(), [&](PHINode &Phi) { return &Phi != IV; })) {
+    return false;
+  }
+
+  auto *Br = dyn_cast<BranchInst>(Header->getTerminator());
+  if (!Br || !Br->isConditional() || !L->contains(Br->getSuccessor(0))) {
+    return false;
+  }
+
+  auto *Cmp = dyn_cast<ICmpInst>(Br->getCondition());
+  if (!Cmp || Cmp->getParent() != Header ||
+      (Cmp->getOperand(0) != IV && Cmp->getOperand(1) != IV)) {
+    return false;
+  }
+
+  bool isLHS = Cmp->getOperand(0) == IV;
+  Value *Bound = Cmp->getOperand(isLHS ? 1 : 0);
+  ICmpInst::Predicate Pred =
+      isLHS ? Cmp->getPredicate() : Cmp->getSwappedPredicate();
+  if ((Pred != ICmpInst::ICMP_SLT && Pred != ICmpInst::ICMP_ULT &&
+       Pred != ICmpInst::ICMP_NE) ||
+      !Outermost->isLoopInvariant(Bound)) {
+    return false;
+  }
+
+  const SCEV *BackedgeTakenCount = SE.getBackedgeTakenCount(L);
+  if (isa<SCEVCouldNotCompute>(BackedgeTakenCount) ||
+      !SE.isLoopInvariant(BackedgeTakenCount, Outermost)) {
+    return false;
+  }
+
+  Level = {L, IV, Cmp, Bound, Pred == ICmpInst::ICMP_SLT};
+  return true;
+}
+
+// Un nido è perfetto se i loop esterni contengono solo il loop successivo,
+// oltre a calcoli senza effetti e senza letture dalla memoria, che dopo il
+// tiling vengono rieseguiti per ogni tile. Il corpo del loop più interno
+// non ha vincoli.
+bool isPerfectlyNested(ArrayRef<NestLevel> Levels, LoopInfo &LI) {
+  for (const NestLevel &Level : Levels.drop_back()) {
+    for (BasicBlock *BB : Level.L->blocks()) {
+      if (LI.getLoopFor(BB) != Level.L) {
+        continue;
+      }
+      for (Instruction &I : *BB) {
+        if ((isa<PHINode>(I) && &I != Level.IV) || I.mayHaveSideEffects() ||
+            I.mayReadFromMemory()) {
+          return false;
+        }
+      }
+    }
+  }
+
+  // I valori del nido non possono essere usati dopo: l'ultima iterazione
+  // del nido non è più l'ultima eseguita
+  Loop *Outermost = Levels.front().L;
+  if (!Outermost->getExitBlock()->phis().empty()) {
+    return false;
+  }
+  for (BasicBlock *BB : Outermost->blocks()) {
+    for (Instruction &I : *BB) {
+      for (User *U : I.users()) {
+        if (!Outermost->contains(cast<Instruction>(U))) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// Il tiling esegue le iterazioni del nido in un ordine diverso: è legale se
+// ogni dipendenza ha, per ogni loop del nido, distanza nulla o dello stesso
+// segno della prima distanza non nulla. Come nella fusione, le coppie di
+// letture e di oggetti identificati distinti non vengono chieste a DI.
+bool areDependencesTileable(ArrayRef<NestLevel> Levels, DependenceInfo &DI) {
+  Loop *Outermost = Levels.front().L;
+  LoopMemoryAccesses Accesses;
+  collectMemoryAccesses(Outermost, Accesses);
+  if (conflictsWithUnknown(Accesses.Unknown, Accesses)) {
+    return false;
+  }
+
+  // I livelli di DI partono dal loop più esterno della funzione
+  unsigned FirstLevel = Outermost->getLoopDepth();
+  unsigned LastLevel = FirstLevel + Levels.size() - 1;
+
+  auto isTileable = [&](Instruction *I0, Instruction *I1) {
+    if (!I0->mayWriteToMemory() && !I1->mayWriteToMemory()) {
+      return true;
+    }
+
+    auto Dep = DI.depends(I0, I1, true);
+    if (!Dep) {
+      return true;
+    }
+    if (Dep->isConfused()) {
+      return false;
+    }
+
+    // Le direzioni descrivono un insieme di vettori di distanza. Un
+    // vettore con la prima componente non nulla First è illegale se una
+    // componente successiva è Second: le iterazioni dipendenti finiscono
+    // in tile eseguiti nell'ordine opposto.
+    auto hasMixedVector = [&](unsigned First, unsigned Second) {
+      for (unsigned Level = FirstLevel; Level <= LastLevel; ++Level) {
+        unsigned Direction = Dep->getDirection(Level);
+        if (Direction & First) {
+          for (unsigned Later = Level + 1; Later <= LastLevel; ++Later) {
+            if (Dep->getDirection(Later) & Second) {
+              return true;
+            }
+          }
+        }
+        if (!(Direction & Dependence::DVEntry::EQ)) {
+          return false;
+        }
+      }
+      return false;
+    };
+
+    // DI può restituire la dipendenza in entrambi i versi
+    return !hasMixedVector(Dependence::DVEntry::LT, Dependence::DVEntry::GT) &&
+           !hasMixedVector(Dependence::DVEntry::GT, Dependence::DVEntry::LT);
+  };
+
+  auto &Objects = Accesses.ByObject;
+  for (auto It0 = Objects.begin(); It0 != Objects.end(); ++It0) {
+    for (auto It1 = It0; It1 != Objects.end(); ++It1) {
+      if (It0 != It1 && !Accesses.Unidentified.contains(It0->first) &&
+          !Accesses.Unidentified.contains(It1->first)) {
+        continue;
+      }
+
+      for (unsigned Idx0 = 0; Idx0 < It0->second.size(); ++Idx0) {
+        for (unsigned Idx1 = It0 == It1 ? Idx0 : 0; Idx1 < It1->second.size();
+             ++Idx1) {
+          if (!isTileable(It0->second[Idx0], It1->second[Idx1])) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// I dati toccati da un tile, B iterazioni per ogni loop, devono stare nella
+// cache. Ogni oggetto è indicizzato al più da due induzioni del nido, come
+// le matrici e le immagini delle convoluzioni: un tile ne tocca B*B
+// elementi. B è la potenza di 2 più grande che ci sta.
+unsigned getTileSize(const LoopMemoryAccesses &Accesses, const DataLayout &DL,
+                     const TargetTransformInfo &TTI) {
+  if (TileSize) {
+    return TileSize;
+  }
+
+  uint64_t Bytes = CacheSize;
+  if (!Bytes) {
+    Bytes = 32 * 1024;
+    if (auto Size = TTI.getCacheSize(TargetTransformInfo::CacheLevel::L1D)) {
+      Bytes = *Size;
+    }
+  }
+
+  uint64_t ElementSize = 1;
+  for (const auto &[Object, Insts] : Accesses.ByObject) {
+    for (Instruction *I : Insts) {
+      ElementSize =
+          max<uint64_t>(ElementSize, DL.getTypeStoreSize(getLoadStoreType(I)));
+    }
+  }
+  uint64_t TileBytes =
+      max<uint64_t>(Accesses.ByObject.size(), 1) * ElementSize;
+
+  unsigned Size = 1;
+  while ((uint64_t)Size * 2 * Size * 2 * TileBytes <= Bytes) {
+    Size *= 2;
+  }
+  return Size;
+}
+
+// Divide in tile i loop marcati. Per ogni loop diviso, dal più esterno,
+// viene creato un loop sui tile, fuori dal nido:
+//
+//   for (ii = 0; ii < N; ii = End)
+//     End = ii + umin(B, N - ii)
+//
+// e il loop originale va da ii a End. I loop sui tile contengono il nido
+// originale, che resta invariato tranne l'inizio e il bound delle induzioni.
+// La differenza N - ii non va in overflow, al contrario di ii + B.
+void tileLoopNest(MutableArrayRef<NestLevel> Levels, unsigned Size,
+                  LoopInfo &LI, DomTreeUpdater &DTU) {
+  Loop *Outermost = Levels.front().L;
+  Loop *Parent = Outermost->getParentLoop();
+  BasicBlock *Preheader = Outermost->getLoopPreheader();
+  BasicBlock *Header = Outermost->getHeader();
+  BasicBlock *Exit = Outermost->getExitBlock();
+  Function *F = Header->getParent();
+  LLVMContext &Ctx = F->getContext();
+
+  SmallVector<DominatorTree::UpdateType, 16> Updates;
+  auto addEdge = [&](BasicBlock *From, BasicBlock *To) {
+    Updates.push_back({DominatorTree::Insert, From, To});
+  };
+
+  // Header e latch dei loop sui tile, dal più esterno. Ogni header entra
+  // nel preheader del successivo, o nel blocco che entra nel nido
+  // originale, ed esce nel latch del loop sui tile che lo contiene, o
+  // nell'uscita del nido.
+  BasicBlock *Entry = Preheader;
+  BasicBlock *ExitTarget = Exit;
+  SmallVector<Loop *, 4> TileLoops;
+  SmallVector<pair<BasicBlock *, BasicBlock *>, 4> TileBlocks;
+  SmallVector<BasicBlock *, 4> TilePreheaders;
+  DenseMap<Loop *, Value *> Starts, Ends;
+  for (NestLevel &Level : Levels) {
+    if (!Level.Tiled) {
+      continue;
+    }
+
+    StringRef BlockName = Level.L->getHeader()->getName();
+    BasicBlock *TileHeader =
+        BasicBlock::Create(Ctx, BlockName + ".tile", F, Header);
+    BasicBlock *TileLatch =
+        BasicBlock::Create(Ctx, BlockName + ".tile.latch", F, Header);
+
+    // Il primo loop sui tile usa il preheader del nido. Gli altri partono
+    // dall'header del loop sui tile che li contiene, che termina con un
+    // branch condizionale: serve un preheader dedicato, come NestEntry per
+    // il nido originale.
+    BasicBlock *TilePreheader = Preheader;
+    if (Entry != Preheader) {
+      TilePreheader =
+          BasicBlock::Create(Ctx, BlockName + ".tile.ph", F, TileHeader);
+      BranchInst::Create(TileHeader, TilePreheader);
+      cast<BranchInst>(Entry->getTerminator())->setSuccessor(0, TilePreheader);
+      addEdge(Entry, TilePreheader);
+    }
+
+    Type *Ty = Level.IV->getType();
+    IRBuilder<> Builder(TileHeader);
+    string Name = (Level.IV->getName() + ".tile").str();
+    PHINode *Start = Builder.CreatePHI(Ty, 2, Name);
+    Start->addIncoming(ConstantInt::get(Ty, 0), TilePreheader);
+    Value *Cond = Builder.CreateICmp(
+        Level.isSigned ? ICmpInst::ICMP_SLT : ICmpInst::ICMP_ULT, Start,
+        Level.Bound, Name + ".cmp");
+    Value *Remaining = Builder.CreateSub(Level.Bound, Start, Name + ".rem");
+    Value *Count = Builder.CreateBinaryIntrinsic(
+        Intrinsic::umin, Remaining, ConstantInt::get(Ty, Size), nullptr,
+        Name + ".size");
+    Value *End = Builder.CreateAdd(Start, Count, Name + ".end");
+    // Il successore nel nido viene fissato al giro successivo
+    Builder.CreateCondBr(Cond, Header, ExitTarget);
+    addEdge(TileHeader, ExitTarget);
+
+    Builder.SetInsertPoint(TileLatch);
+    Builder.CreateBr(TileHeader);
+    addEdge(TileLatch, TileHeader);
+    Start->addIncoming(End, TileLatch);
+
+    if (TilePreheader == Preheader) {
+      Preheader->getTerminator()->replaceSuccessorWith(Header, TileHeader);
+      Updates.push_back({DominatorTree::Delete, Preheader, Header});
+    }
+    addEdge(TilePreheader, TileHeader);
+
+    Starts[Level.L] = Start;
+    Ends[Level.L] = End;
+    TileLoops.push_back(LI.AllocateLoop());
+    TileBlocks.push_back({TileHeader, TileLatch});
+    TilePreheaders.push_back(TilePreheader);
+    Entry = TileHeader;
+    ExitTarget = TileLatch;
+  }
+
+  // Il nido originale parte da un nuovo preheader ed esce nel latch del
+  // loop sui tile più interno
+  BasicBlock *NestEntry =
+      BasicBlock::Create(Ctx, Header->getName() + ".tile.entry", F, Header);
+  BranchInst::Create(Header, NestEntry);
+  cast<BranchInst>(Entry->getTerminator())->setSuccessor(0, NestEntry);
+  addEdge(Entry, NestEntry);
+  addEdge(NestEntry, Header);
+
+  Header->getTerminator()->replaceSuccessorWith(Exit, ExitTarget);
+  Updates.push_back({DominatorTree::Delete, Header, Exit});
+  addEdge(Header, ExitTarget);
+
+  for (NestLevel &Level : Levels) {
+    BasicBlock *LevelPreheader =
+        Level.L == Outermost ? Preheader : Level.L->getLoopPreheader();
+    int Idx = Level.IV->getBasicBlockIndex(LevelPreheader);
+    if (Level.L == Outermost) {
+      Level.IV->setIncomingBlock(Idx, NestEntry);
+    }
+    if (Level.Tiled) {
+      Level.IV->setIncomingValue(Idx, Starts[Level.L]);
+      Level.Cmp->replaceUsesOfWith(Level.Bound, Ends[Level.L]);
+    }
+  }
+
+  DTU.applyUpdates(Updates);
+
+  // I loop sui tile prendono il posto del nido originale, che diventa il
+  // figlio del più interno. Il preheader di un loop sui tile interno sta
+  // nel loop sui tile che lo contiene.
+  for (unsigned Idx = 0; Idx < TileLoops.size(); ++Idx) {
+    Loop *TileLoop = TileLoops[Idx];
+    if (Idx) {
+      TileLoops[Idx - 1]->addChildLoop(TileLoop);
+      TileLoops[Idx - 1]->addBasicBlockToLoop(TilePreheaders[Idx], LI);
+    } else if (Parent) {
+      Parent->replaceChildLoopWith(Outermost, TileLoop);
+    } else {
+      LI.changeTopLevelLoop(Outermost, TileLoop);
+    }
+    TileLoop->addBasicBlockToLoop(TileBlocks[Idx].first, LI);
+    TileLoop->addBasicBlockToLoop(TileBlocks[Idx].second, LI);
+  }
+  TileLoops.back()->addBasicBlockToLoop(NestEntry, LI);
+  TileLoops.back()->addChildLoop(Outermost);
+  for (BasicBlock *BB : Outermost->blocks()) {
+    for (Loop *TileLoop : TileLoops) {
+      TileLoop->addBlockEntry(BB);
+    }
+  }
+}
+
+// Cerca il nido perfetto più profondo che parte da L e lo divide in tile
+// se è legale e utile. Se il nido non va bene, vengono provati i loop
+// interni.
+bool tryTileLoopNest(Loop *L, LoopInfo &LI, ScalarEvolution &SE,
+                     DependenceInfo &DI, const TargetTransformInfo &TTI,
+                     OptimizationRemarkEmitter &ORE,
+                     SmallVectorImpl<SmallVector<NestLevel, 4>> &Nests,
+                     SmallVectorImpl<unsigned> &Sizes) {
+  SmallVector<NestLevel, 4> Levels;
+  for (Loop *Inner = L;; Inner = Inner->getSubLoops().front()) {
+    NestLevel Level;
+    if (!getNestLevel(Inner, L, SE, Level)) {
+      break;
+    }
+    Levels.push_back(Level);
+    if (Inner->getSubLoops().size() != 1) {
+      break;
+    }
+  }
+
+  auto tryInnerLoops = [&]() {
+    bool Found = false;
+    for (Loop *Inner : L->getSubLoops()) {
+      Found |= tryTileLoopNest(Inner, LI, SE, DI, TTI, ORE, Nests, Sizes);
+    }
+    return Found;
+  };
+
+  if (Levels.size() < 2) {
+    return tryInnerLoops();
+  }
+
+  if (!isPerfectlyNested(Levels, LI)) {
+    ++NumNotPerfect;
+    reportNotTiled(ORE, L, "NotPerfect",
+                   "outer loops contain more than the inner loop, or values "
+                   "are used after the nest");
+    return tryInnerLoops();
+  }
+
+  if (!areDependencesTileable(Levels, DI)) {
+    ++NumNotTileable;
+    reportNotTiled(ORE, L, "Dependences",
+                   "dependences change direction between loops of the nest");
+    return tryInnerLoops();
+  }
+
+  // Un loop che fa al più B iterazioni sta già in un tile. Dividere solo
+  // il loop più esterno non cambia l'ordine delle iterazioni.
+  LoopMemoryAccesses Accesses;
+  collectMemoryAccesses(L, Accesses);
+  unsigned Size =
+      getTileSize(Accesses, L->getHeader()->getModule()->getDataLayout(), TTI);
+  bool hasInnerTile = false;
+  for (NestLevel &Level : Levels) {
+    unsigned TripCount = SE.getSmallConstantTripCount(Level.L);
+    Level.Tiled = Size >= 2 && (!TripCount || TripCount > Size);
+    hasInnerTile |= Level.Tiled && Level.L != L;
+  }
+  if (!hasInnerTile) {
+    ++NumFitInTile;
+    reportNotTiled(ORE, L, "FitInTile",
+                   "inner loops already fit in a tile of " + to_string(Size) +
+                       " iterations");
+    return false;
+  }
+
+  Nests.push_back(Levels);
+  Sizes.push_back(Size);
+  return true;
+}
+
+// Il tiling divide ogni loop di un nido perfetto in blocchi di B iterazioni
+// (strip mining) e porta i loop sui blocchi fuori dal nido (interchange):
+// il nido originale lavora su un tile alla volta, che sta nella cache.
+// Prima vengono scelti tutti i nidi, con le analisi ancora valide, poi
+// vengono trasformati.
+PreservedAnalyses LoopTilingPass::run(Function &F,
+                                      FunctionAnalysisManager &AM) {
+  LLVM_DEBUG(dbgs() << "LoopTilingPass: running on " << F.getName() << "\n");
+
+  LoopInfo &LI = AM.getResult<LoopAnalysis>(F);
+  DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
+  ScalarEvolution &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
+  DependenceInfo &DI = AM.getResult<DependenceAnalysis>(F);
+  TargetTransformInfo &TTI = AM.getResult<TargetIRAnalysis>(F);
+  OptimizationRemarkEmitter &ORE =
+      AM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+
+  SmallVector<SmallVector<NestLevel, 4>, 4> Nests;
+  SmallVector<unsigned, 4> Sizes;
+  for (Loop *L : LI) {
+    tryTileLoopNest(L, LI, SE, DI, TTI, ORE, Nests, Sizes);
+  }
+
+  if (Nests.empty()) {
+    return PreservedAnalyses::all();
+  }
+
+  DomTreeUpdater DTU(DT, DomTreeUpdater::UpdateStrategy::Lazy);
+  for (unsigned Idx = 0; Idx < Nests.size(); ++Idx) {
+    MutableArrayRef<NestLevel> Levels = Nests[Idx];
+    Loop *Outermost = Levels.front().L;
+    unsigned NumTiled = count_if(
+        Levels, [](const NestLevel &Level) { return Level.Tiled; });
+
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "Tiled", Outermost->getStartLoc(),
+                                Outermost->getHeader())
+             << "loop nest tiled: " << ore::NV("Loops", NumTiled) << " of "
+             << ore::NV("Depth", (unsigned)Levels.size())
+             << " loops split into tiles of "
+             << ore::NV("TileSize", Sizes[Idx]) << " iterations";
+    });
+
+    tileLoopNest(Levels, Sizes[Idx], LI, DTU);
+    LLVM_DEBUG(dbgs() << "LoopTilingPass: tiled " << Outermost->getName()
+                      << "\n");
+    ++NumNestsTiled;
+    NumLoopsTiled += NumTiled;
+  }
+  DTU.flush();
+
+  // Verifico che la funzione sia corretta
+  if (verifyFunction(F, &errs())) {
+    errs() << "[RUN] Error: Function verification failed after loop tiling\n";
+  }
+
+  // LoopInfo e i dominatori sono aggiornati durante il tiling, SCEV
+  // conosceva i loop con i vecchi bound
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  return PA;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+//===-- LoopTilingPass.h - Custom Transformations ------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// Path:
+//  SRC/llvm/include/llvm/Transforms/Utils/LoopTilingPass.h
+//===----------------------------------------------------------------===//
+#ifndef LLVM_TRANSFORMS_LoopTilingPass_H
+#define LLVM_TRANSFORMS_LoopTilingPass_H
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/PassManager.h"
+
+namespace llvm {
+class LoopTilingPass : public PassInfoMixin<LoopTilingPass> {
+public:
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_LoopTilingPass_H
\ No newline at end of file
@@ -45,3 +45,690 @@ loop2_latch: ; Latch del secondo loop
 loop2_exit: ; Uscita dal secondo loop
   ret void
 }
+
+; Due nidi 2-D con gli stessi bound: vengono fusi i loop esterni e poi,
+; nel giro successivo, i due loop interni diventati fratelli
+define void @test_nests(i32 %n) {
+entry:
+  %a = alloca [10 x [10 x i32]], align 4
+  %b = alloca [10 x [10 x i32]], align 4
+  br label %outer1_header
+
+outer1_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %outer1_latch ]
+  %cmp_i = icmp slt i32 %i, %n
+  br i1 %cmp_i, label %outer1_body, label %outer1_exit
+
+outer1_body:
+  br label %inner1_header
+
+inner1_header:
+  %j = phi i32 [ 0, %outer1_body ], [ %j_next, %inner1_latch ]
+  %cmp_j = icmp slt i32 %j, %n
+  br i1 %cmp_j, label %inner1_body, label %inner1_exit
+
+inner1_body:
+  %idx1 = getelementptr [10 x [10 x i32]], [10 x [10 x i32]]* %a, i32 0, i32 %i, i32 %j
+  store i32 %j, i32* %idx1
+  br label %inner1_latch
+
+inner1_latch:
+  %j_next = add i32 %j, 1
+  br label %inner1_header
+
+inner1_exit:
+  br label %outer1_latch
+
+outer1_latch:
+  %i_next = add i32 %i, 1
+  br label %outer1_header
+
+outer1_exit:
+  br label %outer2_header
+
+outer2_header:
+  %k = phi i32 [ 0, %outer1_exit ], [ %k_next, %outer2_latch ]
+  %cmp_k = icmp slt i32 %k, %n
+  br i1 %cmp_k, label %outer2_body, label %outer2_exit
+
+outer2_body:
+  br label %inner2_header
+
+inner2_header:
+  %l = phi i32 [ 0, %outer2_body ], [ %l_next, %inner2_latch ]
+  %cmp_l = icmp slt i32 %l, %n
+  br i1 %cmp_l, label %inner2_body, label %inner2_exit
+
+inner2_body:
+  %idx2 = getelementptr [10 x [10 x i32]], [10 x [10 x i32]]* %a, i32 0, i32 %k, i32 %l
+  %idx3 = getelementptr [10 x [10 x i32]], [10 x [10 x i32]]* %b, i32 0, i32 %k, i32 %l
+  %val = load i32, i32* %idx2
+  %doubled = shl i32 %val, 1
+  store i32 %doubled, i32* %idx3
+  br label %inner2_latch
+
+inner2_latch:
+  %l_next = add i32 %l, 1
+  br label %inner2_header
+
+inner2_exit:
+  br label %outer2_latch
+
+outer2_latch:
+  %k_next = add i32 %k, 1
+  br label %outer2_header
+
+outer2_exit:
+  ret void
+}
+
+; I primi due loop accedono ad alloca distinte e leggono entrambi %p: le
+; coppie di letture e di oggetti distinti non vengono chieste a DI e i
+; loop vengono fusi. Il terzo scrive in %p l'elemento che i primi due
+; leggono all'iterazione successiva, e resta separato.
+define void @test_objects(i32* %p, i32 %n) {
+entry:
+  %a = alloca [100 x i32], align 4
+  %b = alloca [100 x i32], align 4
+  br label %loop1_header
+
+loop1_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %loop1_latch ]
+  %cmp1 = icmp slt i32 %i, %n
+  br i1 %cmp1, label %loop1_body, label %loop1_exit
+
+loop1_body:
+  %p1 = getelementptr i32, i32* %p, i32 %i
+  %v1 = load i32, i32* %p1
+  %a1 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %i
+  store i32 %v1, i32* %a1
+  br label %loop1_latch
+
+loop1_latch:
+  %i_next = add i32 %i, 1
+  br label %loop1_header
+
+loop1_exit:
+  br label %loop2_header
+
+loop2_header:
+  %j = phi i32 [ 0, %loop1_exit ], [ %j_next, %loop2_latch ]
+  %cmp2 = icmp slt i32 %j, %n
+  br i1 %cmp2, label %loop2_body, label %loop2_exit
+
+loop2_body:
+  %p2 = getelementptr i32, i32* %p, i32 %j
+  %v2 = load i32, i32* %p2
+  %b2 = getelementptr [100 x i32], [100 x i32]* %b, i32 0, i32 %j
+  store i32 %v2, i32* %b2
+  br label %loop2_latch
+
+loop2_latch:
+  %j_next = add i32 %j, 1
+  br label %loop2_header
+
+loop2_exit:
+  br label %loop3_header
+
+loop3_header:
+  %k = phi i32 [ 0, %loop2_exit ], [ %k_next, %loop3_latch ]
+  %cmp3 = icmp slt i32 %k, %n
+  br i1 %cmp3, label %loop3_body, label %loop3_exit
+
+loop3_body:
+  %a3 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %k
+  %v3 = load i32, i32* %a3
+  %k1 = add i32 %k, 1
+  %p3 = getelementptr i32, i32* %p, i32 %k1
+  store i32 %v3, i32* %p3
+  br label %loop3_latch
+
+loop3_latch:
+  %k_next = add i32 %k, 1
+  br label %loop3_header
+
+loop3_exit:
+  ret void
+}
+
+; Catena di tre loop: dopo la fusione dei primi due, il loop fuso viene
+; riprovato con il terzo, che diventa il suo nuovo vicino
+define void @test_chain(i32 %n) {
+entry:
+  %a = alloca [100 x i32], align 4
+  %b = alloca [100 x i32], align 4
+  %c = alloca [100 x i32], align 4
+  br label %chain1_header
+
+chain1_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %chain1_latch ]
+  %cmp1 = icmp slt i32 %i, %n
+  br i1 %cmp1, label %chain1_body, label %chain1_exit
+
+chain1_body:
+  %a1 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %i
+  store i32 %i, i32* %a1
+  br label %chain1_latch
+
+chain1_latch:
+  %i_next = add i32 %i, 1
+  br label %chain1_header
+
+chain1_exit:
+  br label %chain2_header
+
+chain2_header:
+  %j = phi i32 [ 0, %chain1_exit ], [ %j_next, %chain2_latch ]
+  %cmp2 = icmp slt i32 %j, %n
+  br i1 %cmp2, label %chain2_body, label %chain2_exit
+
+chain2_body:
+  %a2 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %j
+  %v2 = load i32, i32* %a2
+  %b2 = getelementptr [100 x i32], [100 x i32]* %b, i32 0, i32 %j
+  store i32 %v2, i32* %b2
+  br label %chain2_latch
+
+chain2_latch:
+  %j_next = add i32 %j, 1
+  br label %chain2_header
+
+chain2_exit:
+  br label %chain3_header
+
+chain3_header:
+  %k = phi i32 [ 0, %chain2_exit ], [ %k_next, %chain3_latch ]
+  %cmp3 = icmp slt i32 %k, %n
+  br i1 %cmp3, label %chain3_body, label %chain3_exit
+
+chain3_body:
+  %b3 = getelementptr [100 x i32], [100 x i32]* %b, i32 0, i32 %k
+  %v3 = load i32, i32* %b3
+  %c3 = getelementptr [100 x i32], [100 x i32]* %c, i32 0, i32 %k
+  store i32 %v3, i32* %c3
+  br label %chain3_latch
+
+chain3_latch:
+  %k_next = add i32 %k, 1
+  br label %chain3_header
+
+chain3_exit:
+  ret void
+}
+
+; Bordi di uno stencil: il primo loop fa un'iterazione in più del secondo,
+; il terzo due. La guardia su %n esclude l'overflow dei bound. Viene
+; staccata la prima iterazione del primo loop, poi le ultime due del terzo,
+; e i tre loop vengono fusi
+define void @test_peel(i32 %n) {
+entry:
+  %a = alloca [100 x i32], align 4
+  %b = alloca [100 x i32], align 4
+  %c = alloca [100 x i32], align 4
+  %n1 = add nuw i32 %n, 1
+  %n2 = add nuw i32 %n, 2
+  %guard = icmp ult i32 %n, 98
+  br i1 %guard, label %peel1_preheader, label %end
+
+peel1_preheader:
+  br label %peel1_header
+
+peel1_header:
+  %i = phi i32 [ 0, %peel1_preheader ], [ %i_next, %peel1_latch ]
+  %cmp1 = icmp ult i32 %i, %n1
+  br i1 %cmp1, label %peel1_body, label %peel1_exit
+
+peel1_body:
+  %a1 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %i
+  store i32 %i, i32* %a1
+  br label %peel1_latch
+
+peel1_latch:
+  %i_next = add nuw i32 %i, 1
+  br label %peel1_header
+
+peel1_exit:
+  br label %peel2_header
+
+peel2_header:
+  %j = phi i32 [ 0, %peel1_exit ], [ %j_next, %peel2_latch ]
+  %cmp2 = icmp ult i32 %j, %n
+  br i1 %cmp2, label %peel2_body, label %peel2_exit
+
+peel2_body:
+  %a2 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %j
+  %v2 = load i32, i32* %a2
+  %b2 = getelementptr [100 x i32], [100 x i32]* %b, i32 0, i32 %j
+  store i32 %v2, i32* %b2
+  br label %peel2_latch
+
+peel2_latch:
+  %j_next = add nuw i32 %j, 1
+  br label %peel2_header
+
+peel2_exit:
+  br label %peel3_header
+
+peel3_header:
+  %k = phi i32 [ 0, %peel2_exit ], [ %k_next, %peel3_latch ]
+  %cmp3 = icmp ult i32 %k, %n2
+  br i1 %cmp3, label %peel3_body, label %peel3_exit
+
+peel3_body:
+  %b3 = getelementptr [100 x i32], [100 x i32]* %b, i32 0, i32 %k
+  %v3 = load i32, i32* %b3
+  %c3 = getelementptr [100 x i32], [100 x i32]* %c, i32 0, i32 %k
+  store i32 %v3, i32* %c3
+  br label %peel3_latch
+
+peel3_latch:
+  %k_next = add nuw i32 %k, 1
+  br label %peel3_header
+
+peel3_exit:
+  br label %end
+
+end:
+  ret void
+}
+
+; I due loop sono legali da fondere ma scrivono array distinti senza
+; leggere niente in comune: la fusione non riusa dati in cache e il
+; modello di costo la scarta
+define void @test_unprofitable(i32 %n) {
+entry:
+  %a = alloca [100 x i32], align 4
+  %b = alloca [100 x i32], align 4
+  br label %stream1_header
+
+stream1_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %stream1_latch ]
+  %cmp1 = icmp slt i32 %i, %n
+  br i1 %cmp1, label %stream1_body, label %stream1_exit
+
+stream1_body:
+  %a1 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %i
+  store i32 %i, i32* %a1
+  br label %stream1_latch
+
+stream1_latch:
+  %i_next = add i32 %i, 1
+  br label %stream1_header
+
+stream1_exit:
+  br label %stream2_header
+
+stream2_header:
+  %j = phi i32 [ 0, %stream1_exit ], [ %j_next, %stream2_latch ]
+  %cmp2 = icmp slt i32 %j, %n
+  br i1 %cmp2, label %stream2_body, label %stream2_exit
+
+stream2_body:
+  %b2 = getelementptr [100 x i32], [100 x i32]* %b, i32 0, i32 %j
+  %double = shl i32 %j, 1
+  store i32 %double, i32* %b2
+  br label %stream2_latch
+
+stream2_latch:
+  %j_next = add i32 %j, 1
+  br label %stream2_header
+
+stream2_exit:
+  ret void
+}
+
+; Tra i due loop il frontend calcola il fattore usato dal secondo e legge
+; un elemento scritto dal primo: il calcolo viene spostato prima del primo
+; loop, la lettura dopo il secondo, e i loop diventano adiacenti
+define i32 @test_intervening(i32 %n) {
+entry:
+  %a = alloca [100 x i32], align 4
+  %b = alloca [100 x i32], align 4
+  br label %fill_header
+
+fill_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %fill_latch ]
+  %cmp1 = icmp slt i32 %i, %n
+  br i1 %cmp1, label %fill_body, label %fill_exit
+
+fill_body:
+  %a1 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %i
+  store i32 %i, i32* %a1
+  br label %fill_latch
+
+fill_latch:
+  %i_next = add i32 %i, 1
+  br label %fill_header
+
+fill_exit:
+  %scale = mul i32 %n, 3
+  %first_ptr = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 0
+  %first = load i32, i32* %first_ptr
+  br label %scale_header
+
+scale_header:
+  %j = phi i32 [ 0, %fill_exit ], [ %j_next, %scale_latch ]
+  %cmp2 = icmp slt i32 %j, %n
+  br i1 %cmp2, label %scale_body, label %scale_exit
+
+scale_body:
+  %a2 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %j
+  %val = load i32, i32* %a2
+  %mul = mul i32 %val, %scale
+  %b2 = getelementptr [100 x i32], [100 x i32]* %b, i32 0, i32 %j
+  store i32 %mul, i32* %b2
+  br label %scale_latch
+
+scale_latch:
+  %j_next = add i32 %j, 1
+  br label %scale_header
+
+scale_exit:
+  ret i32 %first
+}
+
+; Induzioni non canoniche: il secondo loop conta da 1 a %n e legge
+; l'elemento precedente, il terzo scrive %c con un puntatore. Le loro
+; induzioni vengono ricalcolate da quella del primo loop e i tre loop
+; vengono fusi
+define void @test_inductions(i32 %n) {
+entry:
+  %a = alloca [100 x i32], align 4
+  %b = alloca [100 x i32], align 4
+  %c = alloca [100 x i32], align 4
+  %c_start = getelementptr [100 x i32], [100 x i32]* %c, i32 0, i32 0
+  br label %count_header
+
+count_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %count_latch ]
+  %cmp1 = icmp slt i32 %i, %n
+  br i1 %cmp1, label %count_body, label %count_exit
+
+count_body:
+  %a1 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %i
+  store i32 %i, i32* %a1
+  br label %count_latch
+
+count_latch:
+  %i_next = add nsw i32 %i, 1
+  br label %count_header
+
+count_exit:
+  br label %offset_header
+
+offset_header:
+  %j = phi i32 [ 1, %count_exit ], [ %j_next, %offset_latch ]
+  %cmp2 = icmp sle i32 %j, %n
+  br i1 %cmp2, label %offset_body, label %offset_exit
+
+offset_body:
+  %j_prev = add nsw i32 %j, -1
+  %a2 = getelementptr [100 x i32], [100 x i32]* %a, i32 0, i32 %j_prev
+  %val = load i32, i32* %a2
+  %double = shl i32 %val, 1
+  %b2 = getelementptr [100 x i32], [100 x i32]* %b, i32 0, i32 %j_prev
+  store i32 %double, i32* %b2
+  br label %offset_latch
+
+offset_latch:
+  %j_next = add nsw i32 %j, 1
+  br label %offset_header
+
+offset_exit:
+  br label %walk_header
+
+walk_header:
+  %k = phi i32 [ 0, %offset_exit ], [ %k_next, %walk_latch ]
+  %ptr = phi i32* [ %c_start, %offset_exit ], [ %ptr_next, %walk_latch ]
+  %cmp3 = icmp slt i32 %k, %n
+  br i1 %cmp3, label %walk_body, label %walk_exit
+
+walk_body:
+  %b3 = getelementptr [100 x i32], [100 x i32]* %b, i32 0, i32 %k
+  %elem = load i32, i32* %b3
+  store i32 %elem, i32* %ptr
+  %ptr_next = getelementptr i32, i32* %ptr, i32 1
+  br label %walk_latch
+
+walk_latch:
+  %k_next = add nsw i32 %k, 1
+  br label %walk_header
+
+walk_exit:
+  ret void
+}
+
+; Il primo loop scrive %tmp e %kept, il secondo li legge allo stesso
+; indice: dopo la fusione i valori passano nei registri. %tmp non viene
+; più letto e sparisce, %kept è letto dopo il loop e resta in memoria
+define i32 @test_forwarding(i32* noalias %in, i32* noalias %out, i32 %n) {
+entry:
+  %tmp = alloca [100 x i32], align 4
+  %kept = alloca [100 x i32], align 4
+  br label %produce_header
+
+produce_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %produce_latch ]
+  %cmp1 = icmp slt i32 %i, %n
+  br i1 %cmp1, label %produce_body, label %produce_exit
+
+produce_body:
+  %in1 = getelementptr i32, i32* %in, i32 %i
+  %x = load i32, i32* %in1
+  %scaled = mul i32 %x, 3
+  %tmp1 = getelementptr [100 x i32], [100 x i32]* %tmp, i32 0, i32 %i
+  store i32 %scaled, i32* %tmp1
+  %kept1 = getelementptr [100 x i32], [100 x i32]* %kept, i32 0, i32 %i
+  store i32 %x, i32* %kept1
+  br label %produce_latch
+
+produce_latch:
+  %i_next = add nsw i32 %i, 1
+  br label %produce_header
+
+produce_exit:
+  br label %consume_header
+
+consume_header:
+  %j = phi i32 [ 0, %produce_exit ], [ %j_next, %consume_latch ]
+  %cmp2 = icmp slt i32 %j, %n
+  br i1 %cmp2, label %consume_body, label %consume_exit
+
+consume_body:
+  %tmp2 = getelementptr [100 x i32], [100 x i32]* %tmp, i32 0, i32 %j
+  %y = load i32, i32* %tmp2
+  %kept2 = getelementptr [100 x i32], [100 x i32]* %kept, i32 0, i32 %j
+  %z = load i32, i32* %kept2
+  %sum = add i32 %y, %z
+  %out2 = getelementptr i32, i32* %out, i32 %j
+  store i32 %sum, i32* %out2
+  br label %consume_latch
+
+consume_latch:
+  %j_next = add nsw i32 %j, 1
+  br label %consume_header
+
+consume_exit:
+  %first = getelementptr [100 x i32], [100 x i32]* %kept, i32 0, i32 0
+  %res = load i32, i32* %first
+  ret i32 %res
+}
+
+; Unroll-and-jam, con OPT_FLAGS="-loopfusionpass-unroll-and-jam=2
+; -da-disable-delinearization-checks": la riga i + 1 letta dall'iterazione
+; i è la riga i letta dall'iterazione successiva. Il loop esterno viene
+; srotolato di 2, le due copie del loop interno fuse e il load ripetuto
+; prende il valore già nei registri. Le righe rimaste se %n è dispari sono
+; elaborate da una copia del nido dopo il loop.
+define void @test_unroll_and_jam([64 x i32]* noalias %in, [64 x i32]* noalias %out, i32 %n) {
+entry:
+  br label %rows_header
+
+rows_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %rows_latch ]
+  %cmp1 = icmp slt i32 %i, %n
+  br i1 %cmp1, label %rows_body, label %rows_exit
+
+rows_body:
+  %below = add nsw i32 %i, 1
+  br label %cols_header
+
+cols_header:
+  %j = phi i32 [ 0, %rows_body ], [ %j_next, %cols_latch ]
+  %cmp2 = icmp slt i32 %j, 64
+  br i1 %cmp2, label %cols_body, label %cols_exit
+
+cols_body:
+  %in1 = getelementptr [64 x i32], [64 x i32]* %in, i32 %i, i32 %j
+  %x = load i32, i32* %in1
+  %in2 = getelementptr [64 x i32], [64 x i32]* %in, i32 %below, i32 %j
+  %y = load i32, i32* %in2
+  %sum = add i32 %x, %y
+  %out1 = getelementptr [64 x i32], [64 x i32]* %out, i32 %i, i32 %j
+  store i32 %sum, i32* %out1
+  br label %cols_latch
+
+cols_latch:
+  %j_next = add nsw i32 %j, 1
+  br label %cols_header
+
+cols_exit:
+  br label %rows_latch
+
+rows_latch:
+  %i_next = add nsw i32 %i, 1
+  br label %rows_header
+
+rows_exit:
+  ret void
+}
+
+; Indice stretto che va in overflow: %j è un i8 e i loop fanno 300
+; iterazioni, quindi A[zext %j] letto dal secondo loop all'iterazione 10 è
+; quello scritto dal primo all'iterazione 266. L'estensione non si può
+; distribuire sulla ricorrenza e i loop restano separati.
+define void @test_narrow_wrap(i32* noalias %a, i32* noalias %b) {
+entry:
+  br label %write_header
+
+write_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %write_latch ]
+  %j = phi i8 [ 0, %entry ], [ %j_next, %write_latch ]
+  %cmp1 = icmp slt i32 %i, 300
+  br i1 %cmp1, label %write_body, label %write_exit
+
+write_body:
+  %j_ext = zext i8 %j to i64
+  %a1 = getelementptr i32, i32* %a, i64 %j_ext
+  store i32 %i, i32* %a1
+  br label %write_latch
+
+write_latch:
+  %i_next = add nsw i32 %i, 1
+  %j_next = add i8 %j, 1
+  br label %write_header
+
+write_exit:
+  br label %read_header
+
+read_header:
+  %k = phi i32 [ 0, %write_exit ], [ %k_next, %read_latch ]
+  %l = phi i8 [ 0, %write_exit ], [ %l_next, %read_latch ]
+  %cmp2 = icmp slt i32 %k, 300
+  br i1 %cmp2, label %read_body, label %read_exit
+
+read_body:
+  %l_ext = zext i8 %l to i64
+  %a2 = getelementptr i32, i32* %a, i64 %l_ext
+  %val = load i32, i32* %a2
+  %b2 = getelementptr i32, i32* %b, i32 %k
+  store i32 %val, i32* %b2
+  br label %read_latch
+
+read_latch:
+  %k_next = add nsw i32 %k, 1
+  %l_next = add i8 %l, 1
+  br label %read_header
+
+read_exit:
+  ret void
+}
+
+; Stessa distanza alla stessa iterazione: entrambi i nidi accedono a
+; A[i + j]. Il secondo, all'iterazione esterna i, legge A[i + 9], che il
+; primo scrive solo all'iterazione i + 9: i loop esterni restano separati.
+define void @test_same_address_nest(i32* noalias %a, i32* noalias %b) {
+entry:
+  br label %outer1_header
+
+outer1_header:
+  %i = phi i64 [ 0, %entry ], [ %i_next, %outer1_latch ]
+  %cmp_i = icmp slt i64 %i, 10
+  br i1 %cmp_i, label %outer1_body, label %outer1_exit
+
+outer1_body:
+  br label %inner1_header
+
+inner1_header:
+  %j = phi i64 [ 0, %outer1_body ], [ %j_next, %inner1_latch ]
+  %cmp_j = icmp slt i64 %j, 10
+  br i1 %cmp_j, label %inner1_body, label %inner1_exit
+
+inner1_body:
+  %sum1 = add nsw i64 %i, %j
+  %idx1 = getelementptr i32, i32* %a, i64 %sum1
+  %val1 = trunc i64 %j to i32
+  store i32 %val1, i32* %idx1
+  br label %inner1_latch
+
+inner1_latch:
+  %j_next = add nsw i64 %j, 1
+  br label %inner1_header
+
+inner1_exit:
+  br label %outer1_latch
+
+outer1_latch:
+  %i_next = add nsw i64 %i, 1
+  br label %outer1_header
+
+outer1_exit:
+  br label %outer2_header
+
+outer2_header:
+  %k = phi i64 [ 0, %outer1_exit ], [ %k_next, %outer2_latch ]
+  %cmp_k = icmp slt i64 %k, 10
+  br i1 %cmp_k, label %outer2_body, label %outer2_exit
+
+outer2_body:
+  br label %inner2_header
+
+inner2_header:
+  %l = phi i64 [ 0, %outer2_body ], [ %l_next, %inner2_latch ]
+  %cmp_l = icmp slt i64 %l, 10
+  br i1 %cmp_l, label %inner2_body, label %inner2_exit
+
+inner2_body:
+  %sum2 = add nsw i64 %k, %l
+  %idx2 = getelementptr i32, i32* %a, i64 %sum2
+  %val2 = load i32, i32* %idx2
+  %row = mul nsw i64 %k, 10
+  %sum3 = add nsw i64 %row, %l
+  %idx3 = getelementptr i32, i32* %b, i64 %sum3
+  store i32 %val2, i32* %idx3
+  br label %inner2_latch
+
+inner2_latch:
+  %l_next = add nsw i64 %l, 1
+  br label %inner2_header
+
+inner2_exit:
+  br label %outer2_latch
+
+outer2_latch:
+  %k_next = add nsw i64 %k, 1
+  br label %outer2_header
+
+outer2_exit:
+  ret void
+}
@@ -0,0 +1,196 @@
+; ModuleID = 'LoopTilingTest'
+source_filename = "LoopTilingTest"
+
+@A = global [256 x [256 x i32]] zeroinitializer
+@B = global [256 x [256 x i32]] zeroinitializer
+@C = global [256 x [256 x i32]] zeroinitializer
+
+; I test vanno eseguiti con OPT_FLAGS=-da-disable-delinearization-checks:
+; DI assume che gli indici restino nei limiti di ogni dimensione, come in C
+
+; Prodotto di matrici: C[i][j] dipende solo dalle iterazioni precedenti di
+; k, i tre loop vengono divisi in tile che stanno nella cache L1
+define void @test_matmul() {
+entry:
+  br label %i_header
+
+i_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %i_latch ]
+  %cmp_i = icmp slt i32 %i, 256
+  br i1 %cmp_i, label %i_body, label %i_exit
+
+i_body:
+  br label %j_header
+
+j_header:
+  %j = phi i32 [ 0, %i_body ], [ %j_next, %j_latch ]
+  %cmp_j = icmp slt i32 %j, 256
+  br i1 %cmp_j, label %j_body, label %j_exit
+
+j_body:
+  br label %k_header
+
+k_header:
+  %k = phi i32 [ 0, %j_body ], [ %k_next, %k_latch ]
+  %cmp_k = icmp slt i32 %k, 256
+  br i1 %cmp_k, label %k_body, label %k_exit
+
+k_body:
+  %pa = getelementptr [256 x [256 x i32]], [256 x [256 x i32]]* @A, i32 0, i32 %i, i32 %k
+  %a = load i32, i32* %pa
+  %pb = getelementptr [256 x [256 x i32]], [256 x [256 x i32]]* @B, i32 0, i32 %k, i32 %j
+  %b = load i32, i32* %pb
+  %pc = getelementptr [256 x [256 x i32]], [256 x [256 x i32]]* @C, i32 0, i32 %i, i32 %j
+  %c = load i32, i32* %pc
+  %mul = mul i32 %a, %b
+  %sum = add i32 %c, %mul
+  store i32 %sum, i32* %pc
+  br label %k_latch
+
+k_latch:
+  %k_next = add nsw i32 %k, 1
+  br label %k_header
+
+k_exit:
+  br label %j_latch
+
+j_latch:
+  %j_next = add nsw i32 %j, 1
+  br label %j_header
+
+j_exit:
+  br label %i_latch
+
+i_latch:
+  %i_next = add nsw i32 %i, 1
+  br label %i_header
+
+i_exit:
+  ret void
+}
+
+; Trasposta: le righe di %A e le colonne di %B vengono lette e scritte a
+; blocchi. Il calcolo della riga nel loop esterno non ha effetti e viene
+; ripetuto per ogni tile.
+define void @test_transpose() {
+entry:
+  br label %row_header
+
+row_header:
+  %r = phi i32 [ 0, %entry ], [ %r_next, %row_latch ]
+  %cmp_r = icmp slt i32 %r, 256
+  br i1 %cmp_r, label %row_body, label %row_exit
+
+row_body:
+  %r2 = add i32 %r, 0
+  br label %col_header
+
+col_header:
+  %c = phi i32 [ 0, %row_body ], [ %c_next, %col_latch ]
+  %cmp_c = icmp slt i32 %c, 256
+  br i1 %cmp_c, label %col_body, label %col_exit
+
+col_body:
+  %src = getelementptr [256 x [256 x i32]], [256 x [256 x i32]]* @A, i32 0, i32 %r2, i32 %c
+  %v = load i32, i32* %src
+  %dst = getelementptr [256 x [256 x i32]], [256 x [256 x i32]]* @B, i32 0, i32 %c, i32 %r2
+  store i32 %v, i32* %dst
+  br label %col_latch
+
+col_latch:
+  %c_next = add nsw i32 %c, 1
+  br label %col_header
+
+col_exit:
+  br label %row_latch
+
+row_latch:
+  %r_next = add nsw i32 %r, 1
+  br label %row_header
+
+row_exit:
+  ret void
+}
+
+; Ogni iterazione scrive la riga successiva e legge la colonna successiva:
+; l'elemento scritto in (i, j) viene letto in (i + 1, j - 1). La dipendenza
+; (<, >) cambia direzione e il nido non viene diviso in tile
+define void @test_skewed() {
+entry:
+  br label %i_header
+
+i_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %i_latch ]
+  %cmp_i = icmp slt i32 %i, 255
+  br i1 %cmp_i, label %i_body, label %i_exit
+
+i_body:
+  %i_down = add nsw i32 %i, 1
+  br label %j_header
+
+j_header:
+  %j = phi i32 [ 0, %i_body ], [ %j_next, %j_latch ]
+  %cmp_j = icmp slt i32 %j, 255
+  br i1 %cmp_j, label %j_body, label %j_exit
+
+j_body:
+  %j_right = add nsw i32 %j, 1
+  %src = getelementptr [256 x [256 x i32]], [256 x [256 x i32]]* @A, i32 0, i32 %i, i32 %j_right
+  %v = load i32, i32* %src
+  %dst = getelementptr [256 x [256 x i32]], [256 x [256 x i32]]* @A, i32 0, i32 %i_down, i32 %j
+  store i32 %v, i32* %dst
+  br label %j_latch
+
+j_latch:
+  %j_next = add nsw i32 %j, 1
+  br label %j_header
+
+j_exit:
+  br label %i_latch
+
+i_latch:
+  %i_next = add nsw i32 %i, 1
+  br label %i_header
+
+i_exit:
+  ret void
+}
+
+; Il loop interno fa 8 iterazioni e sta già in un tile: dividere solo il
+; loop esterno non cambierebbe l'ordine degli accessi
+define void @test_small() {
+entry:
+  br label %i_header
+
+i_header:
+  %i = phi i32 [ 0, %entry ], [ %i_next, %i_latch ]
+  %cmp_i = icmp slt i32 %i, 256
+  br i1 %cmp_i, label %i_body, label %i_exit
+
+i_body:
+  br label %j_header
+
+j_header:
+  %j = phi i32 [ 0, %i_body ], [ %j_next, %j_latch ]
+  %cmp_j = icmp slt i32 %j, 8
+  br i1 %cmp_j, label %j_body, label %j_exit
+
+j_body:
+  %dst = getelementptr [256 x [256 x i32]], [256 x [256 x i32]]* @C, i32 0, i32 %i, i32 %j
+  store i32 %j, i32* %dst
+  br label %j_latch
+
+j_latch:
+  %j_next = add nsw i32 %j, 1
+  br label %j_header
+
+j_exit:
+  br label %i_latch
+
+i_latch:
+  %i_next = add nsw i32 %i, 1
+  br label %i_header
+
+i_exit:
+  ret void
+}
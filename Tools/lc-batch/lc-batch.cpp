@@ -0,0 +1,392 @@
+//===-- lc-batch.cpp - Parallel batch driver for the custom passes -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// Path:
+//  SRC/llvm/tools/lc-batch/lc-batch.cpp
+//===--------------------------------------------------------------------===//
+//
+// Esegue una pipeline (di default
+// localopts,function(loop-mssa(licmz),loopfusionpass)) su molti moduli in
+// parallelo, evitando di pagare l'avvio di opt per ogni file. Ogni job ha il
+// proprio LLVMContext, che quindi non viene mai condiviso tra i thread. Con
+// -split un singolo modulo grande viene diviso per funzione in più
+// partizioni elaborate in parallelo.
+//
+//===--------------------------------------------------------------------===//
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LLVMRemarkStreamer.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/TargetParser/Triple.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::OneOrMore,
+                                            cl::desc("<input .ll/.bc files>"));
+
+static cl::opt<std::string> PassPipeline(
+    "passes",
+    cl::init("localopts,function(loop-mssa(licmz),loopfusionpass)"),
+    cl::desc("Pipeline to run on every module"));
+
+static cl::opt<std::string>
+    OutputDirectory("o-dir", cl::init(""),
+                    cl::desc("Directory for the optimized modules (default: "
+                             "next to each input)"));
+
+static cl::opt<bool> OutputAssembly("S", cl::init(false),
+                                    cl::desc("Write textual IR instead of "
+                                             "bitcode"));
+
+static cl::opt<unsigned>
+    NumThreads("j", cl::init(0),
+               cl::desc("Number of worker threads (0 uses all cores)"));
+
+static cl::opt<unsigned>
+    SplitParts("split", cl::init(0),
+               cl::desc("Split every input module by function into N "
+                        "partitions processed in parallel"));
+
+static cl::opt<bool> Verbose("v", cl::init(false),
+                             cl::desc("Print a line for every finished "
+                                      "output"));
+
+static cl::opt<bool>
+    RemarksOutput("remarks", cl::init(false),
+                  cl::desc("Write the optimization remarks of every output to "
+                           "<output>.opt.yaml"));
+
+static cl::opt<std::string>
+    RemarksPasses("remarks-filter", cl::init(""),
+                  cl::desc("Only record remarks from passes whose names "
+                           "match the given regular expression"));
+
+static cl::list<std::string>
+    PassPlugins("load-pass-plugin",
+                cl::desc("Load passes from plugin library"));
+
+namespace {
+
+// Tempo e numero di esecuzioni di un passo, sommati su tutti i thread
+struct PassTiming {
+  unsigned Runs = 0;
+  double Seconds = 0;
+};
+
+// Un'unità di lavoro: un file oppure una partizione di un modulo diviso.
+// Le partizioni sono serializzate in bitcode così che ogni job le possa
+// rileggere nel proprio LLVMContext.
+struct BatchJob {
+  std::string InputName;
+  std::string OutputName;
+  SmallVector<char, 0> Bitcode;
+};
+
+std::mutex OutputMutex;
+StringMap<PassTiming> TotalTimings;
+std::atomic<unsigned> NumFinished{0};
+std::atomic<unsigned> NumFailed{0};
+
+std::string getOutputName(StringRef InputName, int Part) {
+  SmallString<256> Output(InputName);
+  sys::path::replace_extension(Output, "");
+  if (Part >= 0)
+    Output += ".part" + std::to_string(Part);
+  Output += OutputAssembly ? ".optimized.ll" : ".optimized.bc";
+
+  if (OutputDirectory.empty())
+    return std::string(Output);
+
+  SmallString<256> InDirectory(OutputDirectory);
+  sys::path::append(InDirectory, sys::path::filename(Output));
+  return std::string(InDirectory);
+}
+
+// I nomi degli adaptor e dei pass manager non sono passi veri e propri
+bool isPassContainer(StringRef PassName) {
+  return PassName.contains("PassManager") || PassName.contains("PassAdaptor");
+}
+
+// Come opt, il TargetMachine viene costruito dal triple del modulo: senza,
+// TargetIRAnalysis darebbe i costi generici e le decisioni basate sui costi
+// (scomposizione delle mul, modello di costo della fusione) sarebbero
+// diverse da quelle di opt. Un modulo senza triple resta senza target.
+std::unique_ptr<TargetMachine> createTargetMachine(const Module &M) {
+  Triple ModuleTriple(M.getTargetTriple());
+  if (!ModuleTriple.getArch())
+    return nullptr;
+
+  std::string Error;
+  const Target *TheTarget =
+      TargetRegistry::lookupTarget(ModuleTriple.str(), Error);
+  if (!TheTarget) {
+    std::lock_guard<std::mutex> Lock(OutputMutex);
+    WithColor::warning(errs(), "lc-batch")
+        << "failed to create target machine for '" << ModuleTriple.str()
+        << "': " << Error << "\n";
+    return nullptr;
+  }
+
+  return std::unique_ptr<TargetMachine>(TheTarget->createTargetMachine(
+      ModuleTriple.str(), "", "", TargetOptions(), std::nullopt));
+}
+
+bool runJob(BatchJob &Job, unsigned NumJobs) {
+  LLVMContext Context;
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M;
+
+  if (Job.Bitcode.empty()) {
+    M = parseIRFile(Job.InputName, Err, Context);
+  } else {
+    auto Buffer = MemoryBuffer::getMemBuffer(
+        StringRef(Job.Bitcode.data(), Job.Bitcode.size()), Job.InputName,
+        /*RequiresNullTerminator=*/false);
+    M = parseIR(Buffer->getMemBufferRef(), Err, Context);
+  }
+
+  if (!M) {
+    std::lock_guard<std::mutex> Lock(OutputMutex);
+    Err.print("lc-batch", errs());
+    return false;
+  }
+
+  // I remark vengono serializzati in YAML solo se richiesti, altrimenti
+  // i passi non li costruiscono nemmeno
+  std::unique_ptr<ToolOutputFile> RemarksFile;
+  if (RemarksOutput) {
+    SmallString<256> RemarksName(Job.OutputName);
+    sys::path::replace_extension(RemarksName, "opt.yaml");
+    auto RemarksFileOrErr =
+        setupLLVMOptimizationRemarks(Context, RemarksName, RemarksPasses,
+                                     "yaml", /*RemarksWithHotness=*/false);
+    if (!RemarksFileOrErr) {
+      std::lock_guard<std::mutex> Lock(OutputMutex);
+      WithColor::error(errs(), "lc-batch")
+          << toString(RemarksFileOrErr.takeError()) << "\n";
+      return false;
+    }
+    RemarksFile = std::move(*RemarksFileOrErr);
+  }
+
+  // Misura il tempo di ogni passo. I passi possono essere annidati
+  // (adaptor -> passo), quindi gli istanti di inizio stanno su uno stack.
+  PassInstrumentationCallbacks PIC;
+  StringMap<PassTiming> Timings;
+  SmallVector<std::chrono::steady_clock::time_point, 8> StartTimes;
+
+  auto StopTimer = [&](StringRef PassName) {
+    auto Elapsed = std::chrono::steady_clock::now() - StartTimes.pop_back_val();
+    PassTiming &Timing = Timings[PassName];
+    Timing.Runs++;
+    Timing.Seconds += std::chrono::duration<double>(Elapsed).count();
+  };
+  PIC.registerBeforeNonSkippedPassCallback([&](StringRef, Any) {
+    StartTimes.push_back(std::chrono::steady_clock::now());
+  });
+  PIC.registerAfterPassCallback(
+      [&](StringRef PassName, Any, const PreservedAnalyses &) {
+        StopTimer(PassName);
+      });
+  PIC.registerAfterPassInvalidatedCallback(
+      [&](StringRef PassName, const PreservedAnalyses &) {
+        StopTimer(PassName);
+      });
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  std::unique_ptr<TargetMachine> TM = createTargetMachine(*M);
+  PassBuilder PB(TM.get(), PipelineTuningOptions(), {}, &PIC);
+
+  for (const std::string &PluginPath : PassPlugins) {
+    auto Plugin = PassPlugin::Load(PluginPath);
+    if (!Plugin) {
+      std::lock_guard<std::mutex> Lock(OutputMutex);
+      WithColor::error(errs(), "lc-batch") << toString(Plugin.takeError())
+                                           << "\n";
+      return false;
+    }
+    Plugin->registerPassBuilderCallbacks(PB);
+  }
+
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (auto E = PB.parsePassPipeline(MPM, PassPipeline)) {
+    std::lock_guard<std::mutex> Lock(OutputMutex);
+    WithColor::error(errs(), "lc-batch") << toString(std::move(E)) << "\n";
+    return false;
+  }
+
+  MPM.run(*M, MAM);
+
+  // L'output viene scritto appena il job termina
+  std::error_code EC;
+  ToolOutputFile Out(Job.OutputName, EC,
+                     OutputAssembly ? sys::fs::OF_Text : sys::fs::OF_None);
+  if (EC) {
+    std::lock_guard<std::mutex> Lock(OutputMutex);
+    WithColor::error(errs(), "lc-batch")
+        << Job.OutputName << ": " << EC.message() << "\n";
+    return false;
+  }
+
+  if (OutputAssembly)
+    M->print(Out.os(), nullptr);
+  else
+    WriteBitcodeToFile(*M, Out.os());
+  Out.keep();
+  if (RemarksFile)
+    RemarksFile->keep();
+
+  std::lock_guard<std::mutex> Lock(OutputMutex);
+  for (const auto &Entry : Timings) {
+    PassTiming &Total = TotalTimings[Entry.getKey()];
+    Total.Runs += Entry.getValue().Runs;
+    Total.Seconds += Entry.getValue().Seconds;
+  }
+
+  unsigned Finished = ++NumFinished;
+  if (Verbose)
+    errs() << "[" << Finished << "/" << NumJobs << "] " << Job.OutputName
+           << "\n";
+
+  return true;
+}
+
+// Divide un modulo per funzione in SplitParts partizioni serializzate
+bool splitInput(StringRef InputName, std::vector<BatchJob> &Jobs) {
+  LLVMContext Context;
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(InputName, Err, Context);
+  if (!M) {
+    Err.print("lc-batch", errs());
+    return false;
+  }
+
+  int Part = 0;
+  SplitModule(
+      *M, SplitParts,
+      [&](std::unique_ptr<Module> MPart) {
+        BatchJob Job;
+        Job.InputName = InputName.str();
+        Job.OutputName = getOutputName(InputName, Part++);
+        raw_svector_ostream OS(Job.Bitcode);
+        WriteBitcodeToFile(*MPart, OS);
+        Jobs.push_back(std::move(Job));
+      },
+      /*PreserveLocals=*/true);
+
+  return true;
+}
+
+void printReport(unsigned NumJobs, double WallSeconds) {
+  outs() << "===-------------------------------------------------------===\n"
+         << "  lc-batch: " << NumFinished << "/" << NumJobs << " outputs in "
+         << format("%.3f", WallSeconds) << "s ("
+         << format("%.1f", NumFinished / WallSeconds) << " modules/s)\n"
+         << "===-------------------------------------------------------===\n";
+  outs() << format("  %-40s %10s %12s %12s\n", (const char *)"Pass",
+                   (const char *)"Runs", (const char *)"Time (s)",
+                   (const char *)"Runs/s");
+
+  for (const auto &Entry : TotalTimings) {
+    if (isPassContainer(Entry.getKey()))
+      continue;
+
+    const PassTiming &Timing = Entry.getValue();
+    double RunsPerSecond = Timing.Seconds ? Timing.Runs / Timing.Seconds : 0;
+    outs() << format("  %-40s %10u %12.4f %12.1f\n",
+                     Entry.getKey().str().c_str(), Timing.Runs, Timing.Seconds,
+                     RunsPerSecond);
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Parallel batch driver for the custom passes\n");
+
+  if (!OutputDirectory.empty()) {
+    if (std::error_code EC = sys::fs::create_directories(OutputDirectory)) {
+      WithColor::error(errs(), "lc-batch")
+          << OutputDirectory << ": " << EC.message() << "\n";
+      return 1;
+    }
+  }
+
+  std::vector<BatchJob> Jobs;
+  for (const std::string &InputName : InputFilenames) {
+    if (SplitParts > 1) {
+      if (!splitInput(InputName, Jobs))
+        return 1;
+      continue;
+    }
+
+    BatchJob Job;
+    Job.InputName = InputName;
+    Job.OutputName = getOutputName(InputName, -1);
+    Jobs.push_back(std::move(Job));
+  }
+
+  auto Start = std::chrono::steady_clock::now();
+  {
+    ThreadPool Pool(hardware_concurrency(NumThreads));
+    for (BatchJob &Job : Jobs) {
+      Pool.async([&Job, NumJobs = unsigned(Jobs.size())] {
+        if (!runJob(Job, NumJobs))
+          ++NumFailed;
+      });
+    }
+    Pool.wait();
+  }
+  auto Elapsed = std::chrono::steady_clock::now() - Start;
+
+  printReport(Jobs.size(), std::chrono::duration<double>(Elapsed).count());
+  return NumFailed ? 1 : 0;
+}
@@ -0,0 +1,720 @@
+//===-- lc-bench.cpp - Compile-time benchmarks for the custom passes -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// Path:
+//  SRC/llvm/tools/lc-bench/lc-bench.cpp
+//===--------------------------------------------------------------------===//
+//
+// Genera moduli sintetici parametrizzati e misura come localopts, licmz e
+// loopfusionpass scalano: per ogni coppia (generatore, passo) riporta il
+// tempo, il picco di memoria residente e le trasformazioni al secondo.
+// Ogni caso viene eseguito in un processo figlio, così il picco di memoria
+// è solo il suo. I risultati sono scritti in JSON Lines, una riga per caso,
+// per confrontarli tra commit diversi.
+//
+//===--------------------------------------------------------------------===//
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/DiagnosticHandler.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/TargetParser/Host.h"
+#include "llvm/TargetParser/Triple.h"
+
+#ifdef LLVM_ON_UNIX
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string>
+    GeneratorNames("generators", cl::CommaSeparated,
+                   cl::desc("Generators to run (default: all): functions, "
+                            "block, invariants, fusion"));
+
+static cl::list<std::string>
+    PassNames("passes", cl::CommaSeparated,
+              cl::desc("Passes to measure (default: all): localopts, "
+                       "licmz, loopfusionpass"));
+
+static cl::opt<unsigned>
+    NumFunctions("functions", cl::init(2000),
+                 cl::desc("Number of functions of the 'functions' "
+                          "generator"));
+
+static cl::opt<unsigned>
+    BlockSize("block-size", cl::init(10000),
+              cl::desc("Number of arithmetic instructions in the block of "
+                       "the 'block' generator"));
+
+static cl::opt<unsigned>
+    ChainLength("chain-length", cl::init(1000),
+                cl::desc("Length of the invariant chain of the "
+                         "'invariants' generator"));
+
+static cl::opt<unsigned>
+    LoopDepth("loop-depth", cl::init(3),
+              cl::desc("Depth of the loop nest of the 'invariants' "
+                       "generator"));
+
+static cl::opt<unsigned>
+    NumLoops("loops", cl::init(300),
+             cl::desc("Number of adjacent loops of the 'fusion' generator"));
+
+static cl::opt<std::string>
+    TargetTriple("mtriple", cl::init(""),
+                 cl::desc("Target triple of the generated modules (default: "
+                          "the host)"));
+
+static cl::opt<unsigned>
+    Repeat("repeat", cl::init(5),
+           cl::desc("Timed runs of every case, each on a new module"));
+
+static cl::opt<std::string>
+    Label("label", cl::init(""),
+          cl::desc("Label copied into every result, e.g. the commit hash"));
+
+static cl::opt<std::string>
+    OutputFilename("o", cl::init("-"),
+                   cl::desc("Output file for the JSON Lines results"));
+
+static cl::opt<bool>
+    Isolate("isolate", cl::init(true),
+            cl::desc("Run every case in a child process, so that its peak "
+                     "RSS is measured alone"));
+
+static cl::opt<std::string>
+    RunCase("run-case", cl::init(""), cl::Hidden,
+            cl::desc("Run a single <generator>:<pass> case (used by the "
+                     "child processes)"));
+
+static cl::opt<bool> Verbose("v", cl::init(false),
+                             cl::desc("Print a line for every finished "
+                                      "case"));
+
+static cl::list<std::string>
+    PassPlugins("load-pass-plugin",
+                cl::desc("Load passes from plugin library"));
+
+namespace {
+
+// Un generatore riempie il modulo e descrive i suoi parametri
+struct Generator {
+  StringRef Name;
+  void (*Generate)(Module &M);
+  void (*Params)(json::OStream &J);
+};
+
+// Un passo viene misurato da solo, con la pipeline che lo esegue
+struct BenchPass {
+  StringRef Name;
+  StringRef Pipeline;
+};
+
+// Loop canonico for (i = 0; i < Bound; i++) nella forma prodotta da
+// mem2reg: l'header confronta ed esce, il corpo viene riempito da Body e il
+// latch incrementa. Il blocco corrente fa da preheader e alla fine il
+// builder è sull'uscita, che fa da preheader del loop successivo.
+void emitLoop(IRBuilder<> &Builder, Value *Bound, const Twine &Name,
+              function_ref<void(Value *)> Body) {
+  BasicBlock *Preheader = Builder.GetInsertBlock();
+  Function *F = Preheader->getParent();
+  LLVMContext &Context = F->getContext();
+  Type *Ty = Bound->getType();
+
+  BasicBlock *Header = BasicBlock::Create(Context, Name + ".header", F);
+  BasicBlock *BodyBB = BasicBlock::Create(Context, Name + ".body", F);
+  BasicBlock *Latch = BasicBlock::Create(Context, Name + ".latch", F);
+  BasicBlock *Exit = BasicBlock::Create(Context, Name + ".exit", F);
+  Builder.CreateBr(Header);
+
+  Builder.SetInsertPoint(Header);
+  PHINode *IV = Builder.CreatePHI(Ty, 2, Name + ".i");
+  IV->addIncoming(ConstantInt::get(Ty, 0), Preheader);
+  Builder.CreateCondBr(Builder.CreateICmpSLT(IV, Bound), BodyBB, Exit);
+
+  // Il corpo può contenere altri loop: finisce nel blocco corrente
+  Builder.SetInsertPoint(BodyBB);
+  Body(IV);
+  Builder.CreateBr(Latch);
+
+  Builder.SetInsertPoint(Latch);
+  Value *Next = Builder.CreateNSWAdd(IV, ConstantInt::get(Ty, 1),
+                                     Name + ".next");
+  IV->addIncoming(Next, Latch);
+  Builder.CreateBr(Header);
+
+  Builder.SetInsertPoint(Exit);
+}
+
+// Migliaia di funzioni piccole: ognuna ha qualche identità e costante per
+// localopts, un calcolo invariante per licmz e due loop fondibili. Misura
+// il costo fisso di ogni passo per funzione.
+void generateFunctions(Module &M) {
+  LLVMContext &Context = M.getContext();
+  Type *I32 = Type::getInt32Ty(Context);
+  Type *Ptr = PointerType::getUnqual(I32);
+  FunctionType *FT = FunctionType::get(Type::getVoidTy(Context),
+                                       {Ptr, Ptr, I32, I32}, false);
+
+  for (unsigned Idx = 0; Idx < NumFunctions; ++Idx) {
+    Function *F =
+        Function::Create(FT, Function::ExternalLinkage, "f" + Twine(Idx), M);
+    Argument *A = F->getArg(0);
+    Argument *B = F->getArg(1);
+    Argument *N = F->getArg(2);
+    Argument *X = F->getArg(3);
+    A->addAttr(Attribute::NoAlias);
+    B->addAttr(Attribute::NoAlias);
+
+    IRBuilder<> Builder(BasicBlock::Create(Context, "entry", F));
+    Value *Scale = Builder.CreateAdd(X, Builder.getInt32(0));
+    Scale = Builder.CreateMul(Scale, Builder.getInt32(8));
+    Scale = Builder.CreateMul(Scale, Builder.getInt32(10 + Idx % 50));
+    Scale = Builder.CreateUDiv(Scale, Builder.getInt32(4));
+
+    emitLoop(Builder, N, "produce", [&](Value *I) {
+      Value *Invariant = Builder.CreateAdd(
+          Builder.CreateMul(X, Builder.getInt32(3)), Builder.getInt32(Idx));
+      Value *Val = Builder.CreateAdd(Builder.CreateMul(I, Scale), Invariant);
+      Builder.CreateStore(Val, Builder.CreateGEP(I32, A, I));
+    });
+    emitLoop(Builder, N, "consume", [&](Value *I) {
+      Value *Val = Builder.CreateLoad(I32, Builder.CreateGEP(I32, A, I));
+      Builder.CreateStore(Builder.CreateAdd(Val, Builder.getInt32(1)),
+                          Builder.CreateGEP(I32, B, I));
+    });
+    Builder.CreateRetVoid();
+  }
+}
+
+// Un solo blocco con BlockSize istruzioni aritmetiche. Gli operandi sono i
+// valori appena calcolati, così le catene sono lunghe e ogni valore ha
+// più usi. Le istruzioni alternano identità, moltiplicazioni e divisioni
+// per costanti e catene di somme da riassociare.
+void generateBlock(Module &M) {
+  LLVMContext &Context = M.getContext();
+  Type *I32 = Type::getInt32Ty(Context);
+  FunctionType *FT = FunctionType::get(I32, {I32, I32}, false);
+  Function *F = Function::Create(FT, Function::ExternalLinkage, "block", M);
+
+  IRBuilder<> Builder(BasicBlock::Create(Context, "entry", F));
+  std::vector<Value *> Values = {F->getArg(0), F->getArg(1)};
+  for (unsigned Idx = 0; Idx < BlockSize; ++Idx) {
+    Value *Last = Values.back();
+    size_t Window = std::min<size_t>(Values.size(), 16);
+    Value *Other = Values[Values.size() - 1 - (Idx * 7) % Window];
+
+    Value *V = nullptr;
+    switch (Idx % 8) {
+    case 0:
+      V = Builder.CreateAdd(Last, Builder.getInt32(0));
+      break;
+    case 1:
+      V = Builder.CreateMul(Last, Builder.getInt32(1 << (1 + Idx % 5)));
+      break;
+    case 2:
+      V = Builder.CreateMul(Last, Builder.getInt32(3 + 2 * (Idx % 13)));
+      break;
+    case 3:
+      V = Builder.CreateUDiv(Last, Builder.getInt32(1 << (1 + Idx % 4)));
+      break;
+    case 4:
+      V = Builder.CreateSDiv(Last, Builder.getInt32(3 + Idx % 7));
+      break;
+    case 5:
+      V = Builder.CreateAdd(Last, Other);
+      break;
+    case 6:
+      V = Builder.CreateAdd(Last, Builder.getInt32(1 + Idx % 17));
+      break;
+    default:
+      V = Builder.CreateSub(Last, Other);
+      break;
+    }
+    Values.push_back(V);
+  }
+  Builder.CreateRet(Values.back());
+}
+
+// Un nido di LoopDepth loop con, nel loop più interno, una catena di
+// ChainLength istruzioni sugli argomenti. Ogni 16 istruzioni la catena usa
+// l'induzione di un loop esterno: i suoi pezzi sono invarianti in loop di
+// profondità diverse.
+void generateInvariants(Module &M) {
+  LLVMContext &Context = M.getContext();
+  Type *I32 = Type::getInt32Ty(Context);
+  Type *Ptr = PointerType::getUnqual(I32);
+  FunctionType *FT = FunctionType::get(Type::getVoidTy(Context),
+                                       {Ptr, Ptr, I32, I32, I32}, false);
+  Function *F =
+      Function::Create(FT, Function::ExternalLinkage, "invariants", M);
+  Argument *Out = F->getArg(0);
+  Argument *In = F->getArg(1);
+  Argument *N = F->getArg(2);
+  Argument *X = F->getArg(3);
+  Argument *Y = F->getArg(4);
+  Out->addAttr(Attribute::NoAlias);
+  In->addAttr(Attribute::NoAlias);
+
+  IRBuilder<> Builder(BasicBlock::Create(Context, "entry", F));
+  SmallVector<Value *, 4> IVs;
+  std::function<void(unsigned)> EmitLevel = [&](unsigned Level) {
+    emitLoop(Builder, N, "level" + Twine(Level), [&](Value *I) {
+      IVs.push_back(I);
+      if (Level + 1 < LoopDepth) {
+        EmitLevel(Level + 1);
+      } else {
+        Value *V = Builder.CreateAdd(X, Y);
+        for (unsigned Idx = 0; Idx < ChainLength; ++Idx) {
+          Value *Operand = Idx % 2 ? Y : X;
+          if (IVs.size() > 1 && Idx % 16 == 15)
+            Operand = IVs[(Idx / 16) % (IVs.size() - 1)];
+          if (Idx % 3 == 0)
+            V = Builder.CreateMul(V, Operand);
+          else if (Idx % 3 == 1)
+            V = Builder.CreateXor(V, Operand);
+          else
+            V = Builder.CreateAdd(V, Operand);
+        }
+        // Il load non è sicuro da speculare: resta nel loop e chiude la
+        // catena senza bloccarla
+        V = Builder.CreateAdd(
+            V, Builder.CreateLoad(I32, Builder.CreateGEP(I32, In, Y)));
+        Builder.CreateStore(Builder.CreateAdd(V, I),
+                            Builder.CreateGEP(I32, Out, I));
+      }
+      IVs.pop_back();
+    });
+  };
+  EmitLevel(0);
+  Builder.CreateRetVoid();
+}
+
+// NumLoops loop adiacenti con lo stesso trip count: il loop k legge
+// l'array scritto dal loop k - 1 allo stesso indice, quindi sono tutti
+// fondibili in un solo loop
+void generateFusion(Module &M) {
+  LLVMContext &Context = M.getContext();
+  Type *I32 = Type::getInt32Ty(Context);
+  Type *Ptr = PointerType::getUnqual(I32);
+  constexpr unsigned NumArrays = 8;
+  SmallVector<Type *, NumArrays + 1> Params(NumArrays, Ptr);
+  Params.push_back(I32);
+  FunctionType *FT =
+      FunctionType::get(Type::getVoidTy(Context), Params, false);
+  Function *F = Function::Create(FT, Function::ExternalLinkage, "fusion", M);
+  for (unsigned Idx = 0; Idx < NumArrays; ++Idx)
+    F->getArg(Idx)->addAttr(Attribute::NoAlias);
+  Argument *N = F->getArg(NumArrays);
+
+  IRBuilder<> Builder(BasicBlock::Create(Context, "entry", F));
+  for (unsigned Idx = 0; Idx < NumLoops; ++Idx) {
+    emitLoop(Builder, N, "loop" + Twine(Idx), [&](Value *I) {
+      Value *Src = Builder.CreateGEP(I32, F->getArg(Idx % NumArrays), I);
+      Value *Val = Builder.CreateLoad(I32, Src);
+      Val = Builder.CreateAdd(Val, Builder.getInt32(Idx + 1));
+      Builder.CreateStore(
+          Val, Builder.CreateGEP(I32, F->getArg((Idx + 1) % NumArrays), I));
+    });
+  }
+  Builder.CreateRetVoid();
+}
+
+const Generator Generators[] = {
+    {"functions", generateFunctions,
+     [](json::OStream &J) {
+       J.attribute("functions", int64_t(NumFunctions));
+     }},
+    {"block", generateBlock,
+     [](json::OStream &J) {
+       J.attribute("block-size", int64_t(BlockSize));
+     }},
+    {"invariants", generateInvariants,
+     [](json::OStream &J) {
+       J.attribute("chain-length", int64_t(ChainLength));
+       J.attribute("loop-depth", int64_t(LoopDepth));
+     }},
+    {"fusion", generateFusion,
+     [](json::OStream &J) { J.attribute("loops", int64_t(NumLoops)); }},
+};
+
+const BenchPass BenchPasses[] = {
+    {"localopts", "localopts"},
+    {"licmz", "function(loop-mssa(licmz))"},
+    {"loopfusionpass", "function(loopfusionpass)"},
+};
+
+// Ogni trasformazione dei passi emette un remark "passed": contarli non
+// richiede le statistiche, disponibili solo nelle build con le assert
+struct TransformationCounter : public DiagnosticHandler {
+  unsigned &Count;
+
+  TransformationCounter(unsigned &Count) : Count(Count) {}
+
+  bool handleDiagnostics(const DiagnosticInfo &DI) override {
+    if (DI.getKind() == DK_OptimizationRemark)
+      Count++;
+    return true;
+  }
+
+  bool isPassedOptRemarkEnabled(StringRef) const override { return true; }
+  bool isAnyRemarkEnabled() const override { return true; }
+};
+
+// Picco della memoria residente del processo in KB, 0 se non disponibile
+int64_t getPeakRSSKilobytes() {
+#ifdef LLVM_ON_UNIX
+  struct rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage))
+    return 0;
+#ifdef __APPLE__
+  return Usage.ru_maxrss / 1024;
+#else
+  return Usage.ru_maxrss;
+#endif
+#else
+  return 0;
+#endif
+}
+
+// I moduli generati hanno il triple e il data layout di un target vero:
+// senza TargetMachine TargetIRAnalysis darebbe i costi generici, e le
+// decisioni basate sui costi (scomposizione delle mul in localopts, modello
+// di costo di loopfusionpass) sarebbero diverse da quelle di opt
+std::unique_ptr<TargetMachine> createTargetMachine() {
+  std::string TripleName = Triple::normalize(
+      TargetTriple.empty() ? sys::getDefaultTargetTriple() : TargetTriple);
+  std::string Error;
+  const Target *TheTarget = TargetRegistry::lookupTarget(TripleName, Error);
+  if (!TheTarget) {
+    WithColor::error(errs(), "lc-bench") << Error << "\n";
+    return nullptr;
+  }
+
+  return std::unique_ptr<TargetMachine>(TheTarget->createTargetMachine(
+      TripleName, "", "", TargetOptions(), std::nullopt));
+}
+
+// Esegue la pipeline sul modulo e restituisce i secondi impiegati
+bool runPipeline(Module &M, TargetMachine &TM, StringRef Pipeline,
+                 ArrayRef<PassPlugin> Plugins, double &Seconds) {
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB(&TM);
+  for (const PassPlugin &Plugin : Plugins)
+    Plugin.registerPassBuilderCallbacks(PB);
+
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (auto E = PB.parsePassPipeline(MPM, Pipeline)) {
+    WithColor::error(errs(), "lc-bench") << toString(std::move(E)) << "\n";
+    return false;
+  }
+
+  auto Start = std::chrono::steady_clock::now();
+  MPM.run(M, MAM);
+  auto Elapsed = std::chrono::steady_clock::now() - Start;
+  Seconds = std::chrono::duration<double>(Elapsed).count();
+  return true;
+}
+
+// Esegue un caso e scrive in Line la riga JSON dei risultati. Una prima
+// esecuzione conta le trasformazioni con i remark abilitati, che hanno un
+// costo; le Repeat esecuzioni misurate li lasciano disabilitati. Ogni
+// esecuzione lavora su un modulo nuovo, generato fuori dalla misura.
+bool runCase(const Generator &Gen, const BenchPass &Pass, TargetMachine &TM,
+             ArrayRef<PassPlugin> Plugins, std::string &Line) {
+  unsigned Transformations = 0;
+  unsigned ModuleFunctions = 0;
+  uint64_t ModuleInstructions = 0;
+  int64_t ModuleRSS = 0;
+  std::vector<double> Times;
+
+  for (unsigned Run = 0; Run <= Repeat; ++Run) {
+    LLVMContext Context;
+    Module M(Gen.Name, Context);
+    M.setTargetTriple(TM.getTargetTriple().str());
+    M.setDataLayout(TM.createDataLayout());
+    Gen.Generate(M);
+
+    if (Run == 0) {
+      if (verifyModule(M, &errs())) {
+        WithColor::error(errs(), "lc-bench")
+            << Gen.Name << ": generated module is broken\n";
+        return false;
+      }
+      ModuleFunctions = M.size();
+      ModuleInstructions = M.getInstructionCount();
+      ModuleRSS = getPeakRSSKilobytes();
+      Context.setDiagnosticHandler(
+          std::make_unique<TransformationCounter>(Transformations));
+    }
+
+    double Seconds = 0;
+    if (!runPipeline(M, TM, Pass.Pipeline, Plugins, Seconds))
+      return false;
+    if (Run > 0)
+      Times.push_back(Seconds);
+  }
+
+  std::sort(Times.begin(), Times.end());
+  double Min = Times.empty() ? 0 : Times.front();
+  double Median = Times.empty() ? 0 : Times[Times.size() / 2];
+  double Max = Times.empty() ? 0 : Times.back();
+
+  raw_string_ostream OS(Line);
+  json::OStream J(OS);
+  J.object([&] {
+    J.attribute("label", Label);
+    J.attribute("generator", Gen.Name);
+    J.attribute("pass", Pass.Name);
+    J.attribute("triple", TM.getTargetTriple().str());
+    J.attributeObject("params", [&] { Gen.Params(J); });
+    J.attribute("functions", int64_t(ModuleFunctions));
+    J.attribute("instructions", int64_t(ModuleInstructions));
+    J.attribute("repeat", int64_t(Repeat));
+    J.attribute("seconds_min", Min);
+    J.attribute("seconds_median", Median);
+    J.attribute("seconds_max", Max);
+    J.attribute("transformations", int64_t(Transformations));
+    J.attribute("transformations_per_second",
+                Min > 0 ? Transformations / Min : 0.0);
+    J.attribute("module_rss_kb", ModuleRSS);
+    J.attribute("peak_rss_kb", getPeakRSSKilobytes());
+  });
+  OS.flush();
+  return true;
+}
+
+// Esegue un caso in un processo figlio, che scrive la sua riga in un file
+// temporaneo
+bool runCaseInChild(StringRef Executable, const Generator &Gen,
+                    const BenchPass &Pass, std::string &Line) {
+  SmallString<128> ResultPath;
+  if (std::error_code EC =
+          sys::fs::createTemporaryFile("lc-bench", "jsonl", ResultPath)) {
+    WithColor::error(errs(), "lc-bench")
+        << "cannot create a temporary file: " << EC.message() << "\n";
+    return false;
+  }
+  FileRemover Remover(ResultPath);
+
+  std::vector<std::string> Args = {
+      Executable.str(),
+      ("-run-case=" + Gen.Name + ":" + Pass.Name).str(),
+      ("-o=" + ResultPath).str(),
+      "-repeat=" + std::to_string(Repeat),
+      "-functions=" + std::to_string(NumFunctions),
+      "-block-size=" + std::to_string(BlockSize),
+      "-chain-length=" + std::to_string(ChainLength),
+      "-loop-depth=" + std::to_string(LoopDepth),
+      "-loops=" + std::to_string(NumLoops),
+      "-label=" + Label,
+      "-mtriple=" + TargetTriple,
+  };
+  for (const std::string &PluginPath : PassPlugins)
+    Args.push_back("-load-pass-plugin=" + PluginPath);
+
+  SmallVector<StringRef, 16> ArgRefs(Args.begin(), Args.end());
+  std::string ErrMsg;
+  int Result = sys::ExecuteAndWait(Executable, ArgRefs, std::nullopt, {}, 0,
+                                   0, &ErrMsg);
+  if (Result != 0) {
+    WithColor::error(errs(), "lc-bench")
+        << Gen.Name << ":" << Pass.Name << " failed"
+        << (ErrMsg.empty() ? "" : ": " + ErrMsg) << "\n";
+    return false;
+  }
+
+  auto Buffer = MemoryBuffer::getFile(ResultPath);
+  if (!Buffer) {
+    WithColor::error(errs(), "lc-bench")
+        << ResultPath << ": " << Buffer.getError().message() << "\n";
+    return false;
+  }
+  Line = (*Buffer)->getBuffer().rtrim().str();
+  return true;
+}
+
+template <typename T>
+bool findByName(ArrayRef<T> All, const cl::list<std::string> &Names,
+                StringRef What, std::vector<const T *> &Selected) {
+  if (Names.empty()) {
+    for (const T &Item : All)
+      Selected.push_back(&Item);
+    return true;
+  }
+
+  for (const std::string &Name : Names) {
+    const T *Item = find_if(All, [&](const T &I) { return I.Name == Name; });
+    if (Item == All.end()) {
+      WithColor::error(errs(), "lc-bench")
+          << "unknown " << What << " '" << Name << "'\n";
+      return false;
+    }
+    Selected.push_back(Item);
+  }
+  return true;
+}
+
+void printSummary(ArrayRef<std::string> Lines) {
+  errs() << format("  %-12s %-16s %12s %12s %14s %12s\n",
+                   (const char *)"Generator", (const char *)"Pass",
+                   (const char *)"Time (s)", (const char *)"Transforms",
+                   (const char *)"Transforms/s", (const char *)"Peak (MB)");
+
+  for (const std::string &Line : Lines) {
+    Expected<json::Value> Value = json::parse(Line);
+    if (!Value) {
+      consumeError(Value.takeError());
+      continue;
+    }
+    const json::Object *Result = Value->getAsObject();
+    if (!Result)
+      continue;
+
+    errs() << format(
+        "  %-12s %-16s %12.4f %12lld %14.1f %12.1f\n",
+        Result->getString("generator").value_or("").str().c_str(),
+        Result->getString("pass").value_or("").str().c_str(),
+        Result->getNumber("seconds_min").value_or(0),
+        (long long)Result->getInteger("transformations").value_or(0),
+        Result->getNumber("transformations_per_second").value_or(0),
+        Result->getInteger("peak_rss_kb").value_or(0) / 1024.0);
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  cl::ParseCommandLineOptions(
+      argc, argv, "Compile-time benchmarks for the custom passes\n");
+
+  std::unique_ptr<TargetMachine> TM = createTargetMachine();
+  if (!TM)
+    return 1;
+
+  std::vector<PassPlugin> Plugins;
+  for (const std::string &PluginPath : PassPlugins) {
+    auto Plugin = PassPlugin::Load(PluginPath);
+    if (!Plugin) {
+      WithColor::error(errs(), "lc-bench") << toString(Plugin.takeError())
+                                           << "\n";
+      return 1;
+    }
+    Plugins.push_back(*Plugin);
+  }
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFilename, EC, sys::fs::OF_Text);
+  if (EC) {
+    WithColor::error(errs(), "lc-bench")
+        << OutputFilename << ": " << EC.message() << "\n";
+    return 1;
+  }
+
+  // Processo figlio: un solo caso, senza riepilogo
+  if (!RunCase.empty()) {
+    auto [GenName, PassName] = StringRef(RunCase).split(':');
+    const Generator *Gen = find_if(
+        Generators, [&](const Generator &G) { return G.Name == GenName; });
+    const BenchPass *Pass = find_if(
+        BenchPasses, [&](const BenchPass &P) { return P.Name == PassName; });
+    if (Gen == std::end(Generators) || Pass == std::end(BenchPasses)) {
+      WithColor::error(errs(), "lc-bench")
+          << "unknown case '" << RunCase << "'\n";
+      return 1;
+    }
+
+    std::string Line;
+    if (!runCase(*Gen, *Pass, *TM, Plugins, Line))
+      return 1;
+    Out.os() << Line << "\n";
+    Out.keep();
+    return 0;
+  }
+
+  std::vector<const Generator *> SelectedGenerators;
+  std::vector<const BenchPass *> SelectedPasses;
+  if (!findByName(ArrayRef<Generator>(Generators), GeneratorNames,
+                  "generator", SelectedGenerators) ||
+      !findByName(ArrayRef<BenchPass>(BenchPasses), PassNames, "pass",
+                  SelectedPasses))
+    return 1;
+
+  std::string Executable =
+      sys::fs::getMainExecutable(argv[0], (void *)&getPeakRSSKilobytes);
+
+  std::vector<std::string> Lines;
+  unsigned NumCases = SelectedGenerators.size() * SelectedPasses.size();
+  bool Failed = false;
+  for (const Generator *Gen : SelectedGenerators) {
+    for (const BenchPass *Pass : SelectedPasses) {
+      std::string Line;
+      bool Succeeded = Isolate
+                           ? runCaseInChild(Executable, *Gen, *Pass, Line)
+                           : runCase(*Gen, *Pass, *TM, Plugins, Line);
+      if (!Succeeded) {
+        Failed = true;
+        continue;
+      }
+
+      // Ogni riga viene scritta appena il caso termina
+      Out.os() << Line << "\n";
+      Out.os().flush();
+      Lines.push_back(Line);
+      if (Verbose)
+        errs() << "[" << Lines.size() << "/" << NumCases << "] " << Gen->Name
+               << ":" << Pass->Name << "\n";
+    }
+  }
+  Out.keep();
+
+  printSummary(Lines);
+  return Failed ? 1 : 0;
+}
\ No newline at end of file